@@ -9,6 +9,9 @@ let package = Package(
         .library(
             name: "JJLISO8601DateFormatter",
             targets: ["JJLISO8601DateFormatter"]),
+        .executable(
+            name: "tzsnapshot",
+            targets: ["tzsnapshot"]),
     ],
     dependencies: [
         // Dependencies declare other packages that this package depends on.
@@ -33,6 +36,10 @@ let package = Package(
                 .headerSearchPath("."),
             ]
         ),
+        .target(
+            name: "tzsnapshot",
+            dependencies: ["tzdb"],
+            path: "Sources/tzsnapshot"),
         .target(
             name: "JJLISO8601DateFormatter",
             dependencies: ["JJLInternal"],
@@ -8,53 +8,113 @@ import JJLInternal
 public final class JJLISO8601DateFormatter: Formatter {
     
     private static let gmtTimeZone = TimeZone(identifier: "GMT")!
-    private static var nameToTimeZone: [String: timezone_t] = [:]
-    private static var dictionaryLock: UnsafeMutablePointer<pthread_rwlock_t> = {
-        let lock = UnsafeMutablePointer<pthread_rwlock_t>.allocate(capacity: 1)
-        pthread_rwlock_init(lock, nil)
-        return lock
-    }()
     
-    private var cTimeZone: timezone_t?
-    private let timeZoneVarsLock: UnsafeMutablePointer<pthread_rwlock_t>
-    private var fallbackFormatter: ISO8601DateFormatter?
-    private var _formatOptions: ISO8601DateFormatter.Options
-    private var _timeZone: TimeZone
+    /// Everything that formatting and parsing read. It's never changed once it's published: the setters publish a new one instead, so that
+    /// readers only need an atomic load, rather than a lock that every core using the formatter would contend for.
+    private final class Configuration {
+        let formatOptions: ISO8601DateFormatter.Options
+        let fractionalSecondDigits: Int
+        let timeZone: TimeZone
+        /// Keeps `cTimeZone` from being evicted from the C code's cache
+        let timeZoneHandle: TimeZoneHandle?
+        let cTimeZone: timezone_t?
+        /// `formatOptions` compiled for the C code
+        let formatPlan: OpaquePointer
+        /// Parses when there's no `cTimeZone`
+        let fallbackFormatter: ISO8601DateFormatter?
+        
+        init(formatOptions: ISO8601DateFormatter.Options, fractionalSecondDigits: Int, timeZone: TimeZone, timeZoneHandle: TimeZoneHandle?) {
+            self.formatOptions = formatOptions
+            self.fractionalSecondDigits = fractionalSecondDigits
+            self.timeZone = timeZone
+            self.timeZoneHandle = timeZoneHandle
+            cTimeZone = timeZoneHandle?.cTimeZone
+            formatPlan = JJLISO8601DateFormatter.createFormatPlan(for: formatOptions, fractionalSecondDigits: fractionalSecondDigits)
+            if cTimeZone == nil {
+                let formatter = ISO8601DateFormatter()
+                formatter.formatOptions = formatOptions
+                formatter.timeZone = timeZone
+                fallbackFormatter = formatter
+            } else {
+                fallbackFormatter = nil
+            }
+        }
+        
+        deinit {
+            JJLDestroyFormatPlan(formatPlan)
+        }
+    }
+    
+    /// The current configuration, retained. Readers don't retain the one they load (that would make them contend for its reference count),
+    /// but use it in a read section, so a replaced configuration is retired, and released once no reader can still be using it.
+    private let currentConfiguration: UnsafeMutablePointer<UnsafeMutableRawPointer?>
+    private let writeLock: UnsafeMutablePointer<pthread_mutex_t>
     var alwaysUseNSTimeZone: Bool = false
     
+    /// Calls `body` with the current configuration, without retaining it
+    @inline(__always)
+    private func withConfiguration<T>(_ body: (Configuration) throws -> T) rethrows -> T {
+        JJLEnterReadSection()
+        defer { JJLExitReadSection() }
+        return try Unmanaged<Configuration>.fromOpaque(JJLAtomicLoadPointer(currentConfiguration)!)._withUnsafeGuaranteedRef(body)
+    }
+    
+    /// Publishes a copy of the current configuration with `change` applied
+    private func updateConfiguration(_ change: (Configuration) -> Configuration) {
+        pthread_mutex_lock(writeLock)
+        defer { pthread_mutex_unlock(writeLock) }
+        
+        publish(change(withConfiguration { $0 }))
+    }
+    
+    private func publish(_ configuration: Configuration) {
+        let old = JJLAtomicLoadPointer(currentConfiguration)
+        JJLAtomicStorePointer(currentConfiguration, Unmanaged.passRetained(configuration).toOpaque())
+        if let old = old {
+            JJLRetire(old) { configuration in
+                Unmanaged<Configuration>.fromOpaque(configuration!).release()
+            }
+        }
+    }
+    
     public var timeZone: TimeZone {
         get {
-            return _timeZone
+            return withConfiguration { $0.timeZone }
         }
         set {
-            pthread_rwlock_wrlock(timeZoneVarsLock)
-            defer { pthread_rwlock_unlock(timeZoneVarsLock) }
-            
-            _timeZone = newValue
-            cTimeZone = Self.cTimeZone(for: _timeZone, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
-            
-            if cTimeZone == nil {
-                fallbackFormatter = ISO8601DateFormatter()
-                fallbackFormatter?.formatOptions = _formatOptions
-                fallbackFormatter?.timeZone = _timeZone
-            } else {
-                fallbackFormatter = nil
+            let timeZoneHandle = Self.timeZoneHandle(for: newValue, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
+            updateConfiguration { old in
+                Configuration(formatOptions: old.formatOptions, fractionalSecondDigits: old.fractionalSecondDigits, timeZone: newValue, timeZoneHandle: timeZoneHandle)
             }
         }
     }
     
     public var formatOptions: ISO8601DateFormatter.Options {
         get {
-            return _formatOptions
+            return withConfiguration { $0.formatOptions }
         }
         set {
             assert(Self.isValidFormatOptions(newValue), "Invalid format options. Must be empty or only contain valid options: [.withYear, .withMonth, .withWeekOfYear, .withDay, .withTime, .withTimeZone, .withSpaceBetweenDateAndTime, .withDashSeparatorInDate, .withColonSeparatorInTime, .withColonSeparatorInTimeZone, .withFractionalSeconds, .withFullDate, .withFullTime, .withInternetDateTime]")
             
-            pthread_rwlock_wrlock(timeZoneVarsLock)
-            defer { pthread_rwlock_unlock(timeZoneVarsLock) }
+            updateConfiguration { old in
+                Configuration(formatOptions: newValue, fractionalSecondDigits: old.fractionalSecondDigits, timeZone: old.timeZone, timeZoneHandle: old.timeZoneHandle)
+            }
+        }
+    }
+    
+    /// The number of digits of fractional seconds to write when `formatOptions` includes `.withFractionalSeconds`, from 0 to 9, e.g. 9 for
+    /// "2018-09-13T19:56:48.123456789Z". Strings are parsed to the same precision, ignoring any further digits. The default is 3, which is what
+    /// ISO8601DateFormatter always uses, and 0 is the same as not including `.withFractionalSeconds`.
+    public var fractionalSecondDigits: Int {
+        get {
+            return withConfiguration { $0.fractionalSecondDigits }
+        }
+        set {
+            precondition(0 <= newValue && newValue <= 9, "fractionalSecondDigits must be from 0 to 9")
             
-            _formatOptions = newValue
-            fallbackFormatter?.formatOptions = newValue
+            updateConfiguration { old in
+                Configuration(formatOptions: old.formatOptions, fractionalSecondDigits: newValue, timeZone: old.timeZone, timeZoneHandle: old.timeZoneHandle)
+            }
         }
     }
     
@@ -71,52 +131,62 @@ public final class JJLISO8601DateFormatter: Formatter {
     public override init() {
         Self.performInitialSetupIfNecessary()
         
-        timeZoneVarsLock = UnsafeMutablePointer<pthread_rwlock_t>.allocate(capacity: 1)
-        pthread_rwlock_init(timeZoneVarsLock, nil)
+        currentConfiguration = UnsafeMutablePointer<UnsafeMutableRawPointer?>.allocate(capacity: 1)
+        currentConfiguration.initialize(to: nil)
+        writeLock = UnsafeMutablePointer<pthread_mutex_t>.allocate(capacity: 1)
+        pthread_mutex_init(writeLock, nil)
+        
+        super.init()
         
-        _formatOptions = [
+        let formatOptions: ISO8601DateFormatter.Options = [
             .withInternetDateTime,
             .withDashSeparatorInDate,
             .withColonSeparatorInTime,
             .withColonSeparatorInTimeZone
         ]
-        _timeZone = Self.gmtTimeZone
-        
-        super.init()
-        
-        cTimeZone = Self.cTimeZone(for: _timeZone, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
+        let timeZoneHandle = Self.timeZoneHandle(for: Self.gmtTimeZone, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
+        publish(Configuration(formatOptions: formatOptions, fractionalSecondDigits: Int(kJJLDefaultFractionalSecondDigits), timeZone: Self.gmtTimeZone, timeZoneHandle: timeZoneHandle))
     }
     
     deinit {
-        pthread_rwlock_destroy(timeZoneVarsLock)
-        timeZoneVarsLock.deallocate()
+        // Nothing can be reading it, since nothing has the formatter
+        Unmanaged<Configuration>.fromOpaque(currentConfiguration.pointee!).release()
+        JJLReclaimRetired()
+        currentConfiguration.deallocate()
+        pthread_mutex_destroy(writeLock)
+        writeLock.deallocate()
     }
     
     public required init?(coder: NSCoder) {
         Self.performInitialSetupIfNecessary()
         
-        timeZoneVarsLock = UnsafeMutablePointer<pthread_rwlock_t>.allocate(capacity: 1)
-        pthread_rwlock_init(timeZoneVarsLock, nil)
+        currentConfiguration = UnsafeMutablePointer<UnsafeMutableRawPointer?>.allocate(capacity: 1)
+        currentConfiguration.initialize(to: nil)
+        writeLock = UnsafeMutablePointer<pthread_mutex_t>.allocate(capacity: 1)
+        pthread_mutex_init(writeLock, nil)
         
-        _formatOptions = ISO8601DateFormatter.Options(rawValue: UInt(coder.decodeInteger(forKey: "formatOptions")))
-        _timeZone = coder.decodeObject(forKey: "timeZone") as? TimeZone ?? Self.gmtTimeZone
+        let formatOptions = ISO8601DateFormatter.Options(rawValue: UInt(coder.decodeInteger(forKey: "formatOptions")))
+        var fractionalSecondDigits = Int(kJJLDefaultFractionalSecondDigits)
+        if coder.containsValue(forKey: "fractionalSecondDigits") {
+            fractionalSecondDigits = min(max(coder.decodeInteger(forKey: "fractionalSecondDigits"), 0), 9)
+        }
+        let timeZone = coder.decodeObject(forKey: "timeZone") as? TimeZone ?? Self.gmtTimeZone
         alwaysUseNSTimeZone = coder.decodeBool(forKey: "alwaysUseNSTimeZone")
-        cTimeZone = Self.cTimeZone(for: _timeZone, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
+        let timeZoneHandle = Self.timeZoneHandle(for: timeZone, alwaysUseNSTimeZone: alwaysUseNSTimeZone)
         
         super.init(coder: coder)
         
-        if cTimeZone == nil {
-            fallbackFormatter = ISO8601DateFormatter()
-            fallbackFormatter?.formatOptions = _formatOptions
-            fallbackFormatter?.timeZone = _timeZone
-        }
+        publish(Configuration(formatOptions: formatOptions, fractionalSecondDigits: fractionalSecondDigits, timeZone: timeZone, timeZoneHandle: timeZoneHandle))
     }
     
     
     public override func encode(with coder: NSCoder) {
         super.encode(with: coder)
-        coder.encode(Int(_formatOptions.rawValue), forKey: "formatOptions")
-        coder.encode(_timeZone, forKey: "timeZone")
+        withConfiguration { configuration in
+            coder.encode(Int(configuration.formatOptions.rawValue), forKey: "formatOptions")
+            coder.encode(configuration.fractionalSecondDigits, forKey: "fractionalSecondDigits")
+            coder.encode(configuration.timeZone, forKey: "timeZone")
+        }
         coder.encode(alwaysUseNSTimeZone, forKey: "alwaysUseNSTimeZone")
     }
     
@@ -133,59 +203,252 @@ public final class JJLISO8601DateFormatter: Formatter {
     
     // MARK: - Time Zone Handling
     
-    /// Adjusts time zone name for GMT offset formats (e.g., "GMT+0800" -> "GMT-08:00")
-    private static func adjustedTimeZoneName(_ name: String) -> String {
-        let pattern = "^GMT(\\+|-)(\\d{2})(\\d{2})$"
-        guard let regex = try? NSRegularExpression(pattern: pattern, options: []),
-              let match = regex.firstMatch(in: name, options: [], range: NSRange(name.startIndex..., in: name)) else {
-            return name
+    /// Gets the C time zone for the given TimeZone from the C code's cache, pinned for as long as the handle is kept
+    private static func timeZoneHandle(for timeZone: TimeZone, alwaysUseNSTimeZone: Bool) -> TimeZoneHandle? {
+        if alwaysUseNSTimeZone {
+            return nil
+        }
+        
+        let timeZoneHandle = TimeZoneHandle(handle: acquireHandle(for: timeZone))
+        if timeZoneHandle == nil {
+            warnAboutMissingTimeZone(timeZone)
+        }
+        return timeZoneHandle
+    }
+    
+    private static func warnAboutMissingTimeZone(_ timeZone: TimeZone) {
+        print("[JJLISO8601DateFormatter] Warning: time zone not found for name \(timeZone.identifier), falling back to NSTimeZone. Performance will be degraded")
+    }
+    
+    /// The C cache's pinned handle for the time zone's identifier, which loads the zone if it isn't cached. Fixed offsets, i.e. "GMT", the
+    /// "GMT+0800" form that TimeZone(secondsFromGMT:) uses, or "GMT+08:00", need nothing loaded, and the C code converts times in them without
+    /// any lookup. Zones that aren't in the time zone files are copied from Foundation.
+    private static func acquireHandle(for timeZone: TimeZone) -> JJLTimeZoneHandle {
+        var identifier = timeZone.identifier
+        let nsTimeZone = timeZone as NSTimeZone
+        return withExtendedLifetime(nsTimeZone) {
+            identifier.withUTF8 { buffer in
+                buffer.withMemoryRebound(to: CChar.self) { name in
+                    JJLAcquireTimeZoneHandleWithLoader(name.baseAddress, Int32(name.count), { _, _, info in
+                        let timeZone = Unmanaged<NSTimeZone>.fromOpaque(info!).takeUnretainedValue() as TimeZone
+                        return JJLISO8601DateFormatter.synthesizedCTimeZone(for: timeZone)
+                    }, Unmanaged.passUnretained(nsTimeZone).toOpaque())
+                }
+            }
+        }
+    }
+    
+    /// A time zone's history as Foundation has it, in the form that `jjl_tzalloc_transitions` takes
+    private struct TimeZoneHistory {
+        let timeZone: TimeZone
+        let initialOffset: Int
+        let initialIsDaylightSavingTime: Bool
+        private(set) var times: [time_t] = []
+        private(set) var offsets: [Int] = []
+        private(set) var isDaylightSavingTimes: [Bool] = []
+        /// How far the history goes
+        private(set) var end: Date
+        
+        init(timeZone: TimeZone, start: Date) {
+            self.timeZone = timeZone
+            initialOffset = timeZone.secondsFromGMT(for: start)
+            initialIsDaylightSavingTime = timeZone.isDaylightSavingTime(for: start)
+            end = start
         }
         
-        let signRange = Range(match.range(at: 1), in: name)!
-        let hoursRange = Range(match.range(at: 2), in: name)!
-        let minutesRange = Range(match.range(at: 3), in: name)!
+        /// Adds the changes up to `date`. Foundation only gives the changes of daylight saving time, so the periods between them are
+        /// checked every four weeks for a change of the standard offset (e.g. when a zone moves to another), and each span whose ends
+        /// differ is bisected to find it. A change that's undone within four weeks, without a change of daylight saving time, is missed.
+        mutating func extend(through date: Date) {
+            let sampleInterval: TimeInterval = 28 * 86_400
+            while end < date {
+                var next = date
+                if let transition = timeZone.nextDaylightSavingTimeTransition(after: end), transition > end, transition < date {
+                    next = transition
+                }
+                var start = end.timeIntervalSince1970
+                while start < next.timeIntervalSince1970 {
+                    let sample = min(start + sampleInterval, next.timeIntervalSince1970)
+                    appendChanges(after: start, through: sample)
+                    start = sample
+                }
+                end = next
+            }
+        }
+        
+        private mutating func appendChanges(after start: TimeInterval, through end: TimeInterval) {
+            let endDate = Date(timeIntervalSince1970: end)
+            let endOffset = timeZone.secondsFromGMT(for: endDate)
+            let endIsDaylightSavingTime = timeZone.isDaylightSavingTime(for: endDate)
+            let startDate = Date(timeIntervalSince1970: start)
+            if endOffset == timeZone.secondsFromGMT(for: startDate) && endIsDaylightSavingTime == timeZone.isDaylightSavingTime(for: startDate) {
+                return
+            }
+            if end - start <= 1 {
+                times.append(time_t(end))
+                offsets.append(endOffset)
+                isDaylightSavingTimes.append(endIsDaylightSavingTime)
+                return
+            }
+            let middle = ((start + end) / 2).rounded(.down)
+            appendChanges(after: start, through: middle)
+            appendChanges(after: middle, through: end)
+        }
+        
+        /// The yearly rule that the last year of the history implies, if the zone still changes to daylight saving time
+        func inferredRule() -> String? {
+            guard let last = times.last, TimeInterval(last) > end.timeIntervalSince1970 - 366 * 86_400 else {
+                return nil
+            }
+            var buffer = [CChar](repeating: 0, count: 128)
+            guard jjl_tzrule_infer(&buffer, buffer.count, times, offsets, isDaylightSavingTimes, Int32(times.count)) else {
+                return nil
+            }
+            return String(cString: buffer)
+        }
         
-        let origSign = name[signRange]
-        let sign: Character = origSign == "-" ? "+" : "-"
-        let hours = name[hoursRange]
-        let minutes = name[minutesRange]
+        func makeCTimeZone(rule: String?) -> timezone_t? {
+            guard let rule = rule else {
+                return jjl_tzalloc_transitions(initialOffset, initialIsDaylightSavingTime, times, offsets, isDaylightSavingTimes, Int32(times.count), nil)
+            }
+            return rule.withCString {
+                jjl_tzalloc_transitions(initialOffset, initialIsDaylightSavingTime, times, offsets, isDaylightSavingTimes, Int32(times.count), $0)
+            }
+        }
         
-        return "GMT\(sign)\(hours):\(minutes)"
+        /// Whether the C time zone has Foundation's offsets from `start` until `limit`, checked at each of Foundation's transitions and every week
+        func matches(_ cTimeZone: timezone_t, from start: Date, until limit: Date) -> Bool {
+            var dates = stride(from: start.timeIntervalSince1970, to: limit.timeIntervalSince1970, by: 7 * 86_400).map(Date.init(timeIntervalSince1970:))
+            var date = start
+            while let transition = timeZone.nextDaylightSavingTimeTransition(after: date), transition > date, transition < limit {
+                dates.append(transition.addingTimeInterval(-1))
+                dates.append(transition)
+                date = transition
+            }
+            return dates.allSatisfy { date in
+                var time = time_t(date.timeIntervalSince1970.rounded(.down))
+                var components = tm()
+                return jjl_localtime_rz(cTimeZone, &time, &components) != nil && components.tm_gmtoff == timeZone.secondsFromGMT(for: date)
+            }
+        }
     }
     
-    /// Gets or creates a C timezone for the given TimeZone (uses global cache)
-    private static func cTimeZone(for timeZone: TimeZone, alwaysUseNSTimeZone: Bool) -> timezone_t? {
-        if alwaysUseNSTimeZone {
-            return nil
+    /// Copies a time zone that isn't in the time zone files (e.g. a custom one, or one that's been renamed, or that a sandbox hides) from
+    /// Foundation, so that it still gets the C code's speed. The history from 1900 to a year from now is copied, after which the zone follows
+    /// the yearly rule that its last year implies, if Foundation agrees with the rule for the following years. If it doesn't, the history is
+    /// copied through 2100 instead, after which the zone stays at its last offset.
+    static func synthesizedCTimeZone(for timeZone: TimeZone) -> timezone_t? {
+        // 1900-01-01, before which Foundation mostly has local mean time
+        var history = TimeZoneHistory(timeZone: timeZone, start: Date(timeIntervalSince1970: -2_208_988_800))
+        history.extend(through: Date(timeIntervalSinceNow: 366 * 86_400))
+        if let rule = history.inferredRule(), let cTimeZone = history.makeCTimeZone(rule: rule) {
+            if history.matches(cTimeZone, from: history.end, until: history.end.addingTimeInterval(4 * 366 * 86_400)) {
+                return cTimeZone
+            }
+            jjl_tzfree(cTimeZone)
         }
+        // 2101-01-01
+        history.extend(through: Date(timeIntervalSince1970: 4_133_980_800))
+        return history.makeCTimeZone(rule: nil)
+    }
+    
+    /// A time zone that's been looked up for the C code, which can be kept so that formatting with it needn't look it up again. The zone
+    /// stays in the C code's cache for as long as the handle exists.
+    public final class TimeZoneHandle: Hashable {
+        private let handle: JJLTimeZoneHandle
+        fileprivate let cTimeZone: timezone_t
         
-        let name = adjustedTimeZoneName(timeZone.identifier)
+        /// Takes over the pin on `handle`, or releases it if it has no zone
+        fileprivate init?(handle: JJLTimeZoneHandle) {
+            guard let cTimeZone = JJLTimeZoneForHandle(handle) else {
+                JJLReleaseTimeZoneHandle(handle)
+                return nil
+            }
+            self.handle = handle
+            self.cTimeZone = cTimeZone
+        }
         
-        // Check global cache first (read lock)
-        pthread_rwlock_rdlock(dictionaryLock)
-        let cached = nameToTimeZone[name]
-        pthread_rwlock_unlock(dictionaryLock)
-        if let cached {
-            return cached
+        /// Takes over `cTimeZone`, which isn't in the cache, and frees it when the handle goes away
+        fileprivate init(ownedTimeZone cTimeZone: timezone_t) {
+            handle = -1
+            self.cTimeZone = cTimeZone
         }
         
-        // Create new timezone
-        let cTimeZone = name.utf8CString.withUnsafeBufferPointer { jjl_tzalloc($0.baseAddress) }
+        deinit {
+            if handle < 0 {
+                jjl_tzfree(cTimeZone)
+            } else {
+                JJLReleaseTimeZoneHandle(handle)
+            }
+        }
         
-        if cTimeZone == nil {
-            print("[JJLISO8601DateFormatter] Warning: time zone not found for name \(name), falling back to NSTimeZone. Performance will be degraded")
-        } else {
-            // Store in global cache (write lock)
-            pthread_rwlock_wrlock(dictionaryLock)
-            nameToTimeZone[name] = cTimeZone
-            pthread_rwlock_unlock(dictionaryLock)
+        public static func == (lhs: TimeZoneHandle, rhs: TimeZoneHandle) -> Bool {
+            return lhs.cTimeZone == rhs.cTimeZone
         }
         
-        return cTimeZone
+        public func hash(into hasher: inout Hasher) {
+            hasher.combine(cTimeZone)
+        }
+    }
+    
+    /// The handle for the time zone, or nil if the C code doesn't have it, in which case it has to be formatted with as a `TimeZone`
+    public static func timeZoneHandle(for timeZone: TimeZone) -> TimeZoneHandle? {
+        performInitialSetupIfNecessary()
+        return TimeZoneHandle(handle: acquireHandle(for: timeZone))
+    }
+    
+    /// The handle for a time zone given as a POSIX TZ string, e.g. "EST5EDT,M3.2.0,M11.1.0", or nil if the string can't be parsed.
+    /// Unlike `timeZoneHandle(for:)`, the string is never taken as a time zone name, and the zone is made just for the handle rather
+    /// than kept in the cache. Its offsets come from the string's rule for whichever year is asked about, so they hold for any date.
+    public static func timeZoneHandle(forPOSIXString string: String) -> TimeZoneHandle? {
+        performInitialSetupIfNecessary()
+        guard let cTimeZone = jjl_tzalloc_posix(string) else {
+            return nil
+        }
+        return TimeZoneHandle(ownedTimeZone: cTimeZone)
+    }
+    
+    /// How well the C code's cache of time zones is doing, for sizing it with `timeZoneCacheCapacity`
+    public struct TimeZoneCacheStatistics {
+        /// Lookups of time zones that were in the cache
+        public let hits: Int
+        /// Lookups of time zones that had to be loaded
+        public let misses: Int
+        public let evictions: Int
+        /// The number of time zones in the cache, which can go over capacity while more than that are in use
+        public let count: Int
+    }
+    
+    public static var timeZoneCacheStatistics: TimeZoneCacheStatistics {
+        let statistics = JJLGetTimeZoneCacheStatistics()
+        return TimeZoneCacheStatistics(hits: Int(statistics.hits), misses: Int(statistics.misses), evictions: Int(statistics.evictions), count: Int(statistics.count))
+    }
+    
+    /// The number of time zones that the C code keeps loaded, shared by all formatters, from 1 to 3072. The default is 1024. Once it's
+    /// reached, loading another evicts the least recently used one that no formatter, context or handle is using.
+    public static var timeZoneCacheCapacity: Int {
+        get {
+            return Int(JJLGetTimeZoneCacheStatistics().capacity)
+        }
+        set {
+            JJLSetTimeZoneCacheCapacity(Int32(clamping: newValue))
+        }
+    }
+    
+    /// Takes time zones from the snapshot at the path (written by the tzsnapshot tool) instead of loading them from the system's files.
+    /// Call it at startup, before formatters are used on other threads. Returns false if the snapshot can't be used, e.g. if it was
+    /// written by a different kind of build, in which case time zones are still loaded as usual.
+    public static func useTimeZoneSnapshot(atPath path: String) -> Bool {
+        return path.withCString { jjl_tzsnapshot_open($0) }
     }
     
     // MARK: - Format Validation
     
+    /// Compiles the options once, so that formatting and parsing don't have to re-decode them every time
+    private static func createFormatPlan(for formatOptions: ISO8601DateFormatter.Options, fractionalSecondDigits: Int) -> OpaquePointer {
+        return JJLCreateFormatPlanWithFractionalSecondDigits(CFISO8601DateFormatOptions(rawValue: UInt(formatOptions.rawValue)), Int32(fractionalSecondDigits))!
+    }
+    
     /// Validates the provided format options.
     public static func isValidFormatOptions(_ formatOptions: ISO8601DateFormatter.Options) -> Bool {
         var mask: ISO8601DateFormatter.Options = [
@@ -207,87 +470,539 @@ public final class JJLISO8601DateFormatter: Formatter {
     
     /// Returns a string representation of the specified date.
     public func string(from date: Date) -> String {
-        pthread_rwlock_rdlock(timeZoneVarsLock)
-        defer { pthread_rwlock_unlock(timeZoneVarsLock) }
-        
-        return Self.stringFromDate(date, formatOptions: _formatOptions, cTimeZone: cTimeZone, timeZone: _timeZone)
+        return withConfiguration { configuration in
+            let formatPlan = configuration.formatPlan
+            let cTimeZone = configuration.cTimeZone
+            let maxLength = Int(JJLMaxLengthForFormatPlan(formatPlan))
+            return Self.stringFromDate(date, cTimeZone: cTimeZone, timeZone: configuration.timeZone, maxLength: maxLength) { buffer, time, offset in
+                JJLFillBufferForDateWithPlan(buffer, time, formatPlan, cTimeZone, offset)
+            }
+        }
+    }
+    
+    /// Returns a string representation of the time `seconds` and `nanoseconds` after 1970, which is exact at any magnitude, unlike a `Date`.
+    /// Fractional seconds are truncated to the precision shown, rather than rounded. The string is empty if the year doesn't fit in an `Int32`.
+    public func string(fromEpochSeconds seconds: Int64, nanoseconds: Int32 = 0) -> String {
+        return stringFromEpoch(seconds: seconds) { buffer, formatPlan, cTimeZone, offset in
+            JJLFillBufferForEpochSeconds(buffer, seconds, nanoseconds, formatPlan, cTimeZone, offset)
+        }
     }
     
+    /// Returns a string representation of the time `milliseconds` after 1970 (before, if negative).
+    public func string(fromEpochMilliseconds milliseconds: Int64) -> String {
+        return stringFromEpoch(seconds: milliseconds / 1_000) { buffer, formatPlan, cTimeZone, offset in
+            JJLFillBufferForEpochMillis(buffer, milliseconds, formatPlan, cTimeZone, offset)
+        }
+    }
+    
+    /// Returns a string representation of the time `microseconds` after 1970 (before, if negative).
+    public func string(fromEpochMicroseconds microseconds: Int64) -> String {
+        return stringFromEpoch(seconds: microseconds / 1_000_000) { buffer, formatPlan, cTimeZone, offset in
+            JJLFillBufferForEpochMicros(buffer, microseconds, formatPlan, cTimeZone, offset)
+        }
+    }
+    
+    /// Returns a string representation of the time `nanoseconds` after 1970 (before, if negative).
+    public func string(fromEpochNanoseconds nanoseconds: Int64) -> String {
+        return stringFromEpoch(seconds: nanoseconds / 1_000_000_000) { buffer, formatPlan, cTimeZone, offset in
+            JJLFillBufferForEpochNanos(buffer, nanoseconds, formatPlan, cTimeZone, offset)
+        }
+    }
+    
+    /// `seconds` is only used to find the fallback offset, so it needn't be rounded in any particular direction.
+    @inline(__always)
+    private func stringFromEpoch(seconds: Int64, fill: (UnsafeMutablePointer<CChar>, OpaquePointer, timezone_t?, Int32) -> Int32) -> String {
+        return withConfiguration { configuration in
+            let formatPlan = configuration.formatPlan
+            let cTimeZone = configuration.cTimeZone
+            let maxLength = Int(JJLMaxLengthForFormatPlan(formatPlan))
+            let date = Date(timeIntervalSince1970: TimeInterval(seconds))
+            return Self.stringFromDate(date, cTimeZone: cTimeZone, timeZone: configuration.timeZone, maxLength: maxLength) { buffer, _, offset in
+                fill(buffer, formatPlan, cTimeZone, Int32(offset))
+            }
+        }
+    }
+
+    /// Returns a context for formatting runs of nearby times, e.g. log timestamps, with the formatter's current settings.
+    public func makeFormattingContext() -> FormattingContext {
+        return withConfiguration { configuration in
+            FormattingContext(formatPlan: configuration.formatPlan, timeZoneHandle: configuration.timeZoneHandle, timeZone: configuration.timeZone)
+        }
+    }
+
+    /// Formats like the formatter it came from, but remembers the last string, so that for a time in the same second only the fractional
+    /// seconds are rewritten, and for one later in the same day (and UTC offset) only the time of day is. A context isn't thread-safe, but
+    /// any number can be used at once, so keep one per thread. Changes to the formatter's settings after it's made don't affect it.
+    public final class FormattingContext {
+        private let context: OpaquePointer
+        /// Keeps `cTimeZone` loaded for the C context
+        private let timeZoneHandle: TimeZoneHandle?
+        private let cTimeZone: timezone_t?
+        private let timeZone: TimeZone
+        private let maxLength: Int
+
+        fileprivate init(formatPlan: OpaquePointer, timeZoneHandle: TimeZoneHandle?, timeZone: TimeZone) {
+            // The context copies the plan
+            context = JJLCreateFormatContext(formatPlan, timeZoneHandle?.cTimeZone)!
+            self.timeZoneHandle = timeZoneHandle
+            cTimeZone = timeZoneHandle?.cTimeZone
+            self.timeZone = timeZone
+            maxLength = Int(JJLMaxLengthForFormatPlan(formatPlan))
+        }
+
+        deinit {
+            JJLDestroyFormatContext(context)
+        }
+
+        /// Returns a string representation of the specified date.
+        public func string(from date: Date) -> String {
+            let context = self.context
+            return JJLISO8601DateFormatter.stringFromDate(date, cTimeZone: cTimeZone, timeZone: timeZone, maxLength: maxLength) { buffer, time, offset in
+                if self.cTimeZone == nil {
+                    // The offset is looked up for each date anyway, so there's nothing to reuse
+                    return JJLFillBufferForDateWithPlan(buffer, time, JJLFormatPlanForContext(context), nil, offset)
+                }
+                return JJLFillBufferForDateWithContext(context, buffer, time)
+            }
+        }
+
+        /// Returns a string representation of the time `seconds` and `nanoseconds` after 1970, like
+        /// `JJLISO8601DateFormatter.string(fromEpochSeconds:nanoseconds:)`.
+        public func string(fromEpochSeconds seconds: Int64, nanoseconds: Int32 = 0) -> String {
+            let context = self.context
+            let date = Date(timeIntervalSince1970: TimeInterval(seconds))
+            return JJLISO8601DateFormatter.stringFromDate(date, cTimeZone: cTimeZone, timeZone: timeZone, maxLength: maxLength) { buffer, _, offset in
+                if self.cTimeZone == nil {
+                    return JJLFillBufferForEpochSeconds(buffer, seconds, nanoseconds, JJLFormatPlanForContext(context), nil, Int32(offset))
+                }
+                return JJLFillBufferForEpochWithContext(context, buffer, seconds, nanoseconds)
+            }
+        }
+    }
+
     /// Returns a date from the specified string, or nil if parsing fails.
     public func date(from string: String) -> Date? {
-        guard !string.isEmpty, !_formatOptions.isEmpty else {
+        return date(fromUTF8Sequence: string.utf8)
+    }
+    
+    /// Returns a date from the specified substring, or nil if parsing fails. The substring isn't copied.
+    public func date(from string: Substring) -> Date? {
+        return date(fromUTF8Sequence: string.utf8)
+    }
+    
+    /// Returns a date from the specified UTF-8 view, or nil if parsing fails.
+    public func date(from utf8: String.UTF8View) -> Date? {
+        return date(fromUTF8Sequence: utf8)
+    }
+    
+    /// Returns a date from the UTF-8 (or ASCII) bytes of a string, or nil if parsing fails.
+    public func date(fromUTF8 bytes: [UInt8]) -> Date? {
+        return bytes.withUnsafeBytes { date(fromUTF8: $0) }
+    }
+    
+    /// Returns a date from the UTF-8 (or ASCII) bytes of a string, or nil if parsing fails.
+    public func date(fromUTF8 data: Data) -> Date? {
+        return data.withUnsafeBytes { date(fromUTF8: $0) }
+    }
+    
+    /// Returns a date from the UTF-8 (or ASCII) bytes of a string, or nil if parsing fails. The bytes don't need to be
+    /// NUL-terminated.
+    public func date(fromUTF8 buffer: UnsafeRawBufferPointer) -> Date? {
+        guard let baseAddress = buffer.baseAddress, buffer.count > 0, buffer.count <= Int32.max else {
             return nil
         }
         
-        pthread_rwlock_rdlock(timeZoneVarsLock)
-        defer { pthread_rwlock_unlock(timeZoneVarsLock) }
-        
-        guard let cTimeZone = cTimeZone else {
-            return fallbackFormatter?.date(from: string)
-        }
-        
-        var errorOccurred = false
-        let interval = string.withCString { cString -> TimeInterval in
-            return JJLTimeIntervalForString(
-                cString,
-                Int32(strlen(cString)),
-                CFISO8601DateFormatOptions(rawValue: UInt(_formatOptions.rawValue)),
+        return withConfiguration { configuration in
+            guard !configuration.formatOptions.isEmpty else {
+                return nil
+            }
+            guard let cTimeZone = configuration.cTimeZone else {
+                return configuration.fallbackFormatter?.date(from: String(decoding: buffer, as: UTF8.self))
+            }
+            
+            var errorOccurred = false
+            let interval = JJLTimeIntervalForStringWithPlan(
+                baseAddress.assumingMemoryBound(to: CChar.self),
+                Int32(buffer.count),
+                configuration.formatPlan,
                 cTimeZone,
                 &errorOccurred
             )
+            
+            return errorOccurred ? nil : Date(timeIntervalSince1970: interval)
+        }
+    }
+    
+    /// Returns the whole seconds since 1970 (rounded down) and the nanoseconds past them for the specified string, or nil if parsing fails.
+    /// Unlike a `Date`, this is exact at any magnitude, to `fractionalSecondDigits` of precision.
+    public func epochSeconds(from string: String) -> (seconds: Int64, nanoseconds: Int32)? {
+        return parseEpoch(string, fallback: Self.epochSeconds(for:)) { bytes, length, formatPlan, cTimeZone in
+            var nanoseconds: Int32 = 0
+            var errorOccurred = false
+            let seconds = JJLEpochSecondsForStringWithPlan(bytes, length, formatPlan, cTimeZone, &nanoseconds, &errorOccurred)
+            return errorOccurred ? nil : (seconds, nanoseconds)
+        }
+    }
+    
+    /// Returns the nanoseconds since 1970 for the specified string, or nil if parsing fails or the time is outside of what fits in an `Int64`,
+    /// i.e. before 1677 or after 2262. This is exact, to `fractionalSecondDigits` of precision.
+    public func epochNanoseconds(from string: String) -> Int64? {
+        let fallback = { (date: Date) -> Int64? in
+            guard let (seconds, nanoseconds) = Self.epochSeconds(for: date) else {
+                return nil
+            }
+            let (product, overflow) = seconds.multipliedReportingOverflow(by: 1_000_000_000)
+            let (sum, sumOverflow) = product.addingReportingOverflow(Int64(nanoseconds))
+            return overflow || sumOverflow ? nil : sum
+        }
+        return parseEpoch(string, fallback: fallback) { bytes, length, formatPlan, cTimeZone in
+            var errorOccurred = false
+            var overflowOccurred = false
+            let nanoseconds = JJLEpochNanosForStringWithPlan(bytes, length, formatPlan, cTimeZone, &errorOccurred, &overflowOccurred)
+            return errorOccurred || overflowOccurred ? nil : nanoseconds
+        }
+    }
+    
+    /// Splits a date from the fallback formatter, which only has millisecond precision anyway
+    private static func epochSeconds(for date: Date) -> (seconds: Int64, nanoseconds: Int32)? {
+        let interval = date.timeIntervalSince1970
+        let seconds = interval.rounded(.down)
+        guard let wholeSeconds = Int64(exactly: seconds) else {
+            return nil
+        }
+        return (wholeSeconds, min(Int32((interval - seconds) * 1_000_000_000), 999_999_999))
+    }
+    
+    /// Runs `parse` on the string's UTF-8 bytes, or when there's no C time zone, `fallback` on the date that the fallback formatter parses
+    private func parseEpoch<T>(
+        _ string: String,
+        fallback: (Date) -> T?,
+        parse: (UnsafePointer<CChar>, Int32, OpaquePointer, timezone_t) -> T?
+    ) -> T? {
+        var string = string
+        return string.withUTF8 { buffer in
+            guard let baseAddress = buffer.baseAddress, buffer.count > 0, buffer.count <= Int32.max else {
+                return nil
+            }
+            
+            return withConfiguration { configuration in
+                guard !configuration.formatOptions.isEmpty else {
+                    return nil
+                }
+                guard let cTimeZone = configuration.cTimeZone else {
+                    return configuration.fallbackFormatter?.date(from: String(decoding: buffer, as: UTF8.self)).flatMap(fallback)
+                }
+                return UnsafeRawPointer(baseAddress).withMemoryRebound(to: CChar.self, capacity: buffer.count) { bytes in
+                    parse(bytes, Int32(buffer.count), configuration.formatPlan, cTimeZone)
+                }
+            }
+        }
+    }
+
+    /// Returns a context for parsing strings that mostly come in order, e.g. the lines of a log, with the formatter's current settings.
+    public func makeParsingContext() -> ParsingContext {
+        return withConfiguration { configuration in
+            ParsingContext(formatPlan: configuration.formatPlan, timeZoneHandle: configuration.timeZoneHandle, formatOptions: configuration.formatOptions, timeZone: configuration.timeZone)
+        }
+    }
+
+    /// Parses like the formatter it came from, but remembers how the last string started, so that when the next one has the same date (and
+    /// usually hour), only the rest of it is parsed. A context isn't thread-safe, but any number can be used at once, so keep one per thread.
+    /// Changes to the formatter's settings after it's made don't affect it.
+    public final class ParsingContext {
+        /// nil when the time zone isn't one the C code has, in which case fallbackFormatter parses instead
+        private let context: OpaquePointer?
+        /// Keeps the C context's time zone loaded
+        private let timeZoneHandle: TimeZoneHandle?
+        private let fallbackFormatter: ISO8601DateFormatter?
+        private let isEmpty: Bool
+
+        fileprivate init(formatPlan: OpaquePointer, timeZoneHandle: TimeZoneHandle?, formatOptions: ISO8601DateFormatter.Options, timeZone: TimeZone) {
+            isEmpty = formatOptions.isEmpty
+            self.timeZoneHandle = timeZoneHandle
+            if let cTimeZone = timeZoneHandle?.cTimeZone {
+                context = JJLCreateParseContext(formatPlan, cTimeZone)!
+                fallbackFormatter = nil
+            } else {
+                context = nil
+                let formatter = ISO8601DateFormatter()
+                formatter.formatOptions = formatOptions
+                formatter.timeZone = timeZone
+                fallbackFormatter = formatter
+            }
+        }
+
+        deinit {
+            if let context = context {
+                JJLDestroyParseContext(context)
+            }
+        }
+
+        /// Returns a date from the specified string, or nil if parsing fails.
+        public func date(from string: String) -> Date? {
+            return parse(string, fallback: { $0 }) { context, bytes, length in
+                var errorOccurred = false
+                let interval = JJLTimeIntervalForStringWithContext(context, bytes, length, &errorOccurred)
+                return errorOccurred ? nil : Date(timeIntervalSince1970: interval)
+            }
+        }
+
+        /// Returns the whole seconds since 1970 and the nanoseconds past them for the specified string, like
+        /// `JJLISO8601DateFormatter.epochSeconds(from:)`.
+        public func epochSeconds(from string: String) -> (seconds: Int64, nanoseconds: Int32)? {
+            return parse(string, fallback: JJLISO8601DateFormatter.epochSeconds(for:)) { context, bytes, length in
+                var nanoseconds: Int32 = 0
+                var errorOccurred = false
+                let seconds = JJLEpochSecondsForStringWithContext(context, bytes, length, &nanoseconds, &errorOccurred)
+                return errorOccurred ? nil : (seconds, nanoseconds)
+            }
+        }
+
+        private func parse<T>(_ string: String, fallback: (Date) -> T?, parse: (OpaquePointer, UnsafePointer<CChar>, Int32) -> T?) -> T? {
+            guard !isEmpty else {
+                return nil
+            }
+            var string = string
+            return string.withUTF8 { buffer in
+                guard let baseAddress = buffer.baseAddress, buffer.count > 0, buffer.count <= Int32.max else {
+                    return nil
+                }
+                guard let context = context else {
+                    return fallbackFormatter?.date(from: String(decoding: buffer, as: UTF8.self)).flatMap(fallback)
+                }
+                return UnsafeRawPointer(baseAddress).withMemoryRebound(to: CChar.self, capacity: buffer.count) { bytes in
+                    parse(context, bytes, Int32(buffer.count))
+                }
+            }
+        }
+    }
+
+    /// Passes contiguous bytes (e.g. those of a native string) straight through, and only copies the ones that
+    /// aren't, such as those of some bridged strings
+    private func date<Bytes: Sequence>(fromUTF8Sequence bytes: Bytes) -> Date? where Bytes.Element == UInt8 {
+        if let parsed = bytes.withContiguousStorageIfAvailable({ self.date(fromUTF8: UnsafeRawBufferPointer($0)) }) {
+            return parsed
+        }
+        return Array(bytes).withUnsafeBytes { self.date(fromUTF8: $0) }
+    }
+    
+    /// Parses many strings at once. Equivalent to calling `date(from:)` on each string, but the format options and
+    /// time zone are resolved once for the whole batch.
+    public func dates(from strings: [String]) -> [Date?] {
+        var bytes: [UInt8] = []
+        var offsets: [Int32] = [0]
+        offsets.reserveCapacity(strings.count + 1)
+        for string in strings {
+            bytes.append(contentsOf: string.utf8)
+            offsets.append(Int32(bytes.count))
+        }
+        var results = [Double](repeating: 0, count: strings.count)
+        var validity = [UInt8](repeating: 0, count: (strings.count + 7) / 8)
+        bytes.withUnsafeBytes { buffer in
+            offsets.withUnsafeBufferPointer { offsetsBuffer in
+                results.withUnsafeMutableBufferPointer { resultsBuffer in
+                    validity.withUnsafeMutableBufferPointer { validityBuffer in
+                        _ = timeIntervals(fromUTF8: buffer, offsets: offsetsBuffer, results: resultsBuffer, validity: validityBuffer)
+                    }
+                }
+            }
+        }
+        return (0..<strings.count).map { i in
+            validity[i >> 3] & (1 << (i & 7)) != 0 ? Date(timeIntervalSince1970: results[i]) : nil
+        }
+    }
+    
+    /// Parses Arrow-style UTF-8 input, where string `i` is `buffer[offsets[i]..<offsets[i + 1]]`.
+    ///
+    /// On return, bit `i` of `validity` (least significant bit first) is set if string `i` parsed, in which case
+    /// `results[i]` holds its time interval since 1970; otherwise `results[i]` is 0. `offsets` must hold
+    /// `results.count + 1` entries and `validity` at least `(results.count + 7) / 8` bytes. Returns the number of
+    /// strings that parsed.
+    public func timeIntervals(
+        fromUTF8 buffer: UnsafeRawBufferPointer,
+        offsets: UnsafeBufferPointer<Int32>,
+        results: UnsafeMutableBufferPointer<Double>,
+        validity: UnsafeMutableBufferPointer<UInt8>
+    ) -> Int {
+        let count = results.count
+        precondition(offsets.count > count, "offsets must have room for results.count + 1 entries")
+        precondition(validity.count >= (count + 7) / 8, "validity must have room for one bit per result")
+        guard count > 0 else {
+            return 0
         }
         
-        return errorOccurred ? nil : Date(timeIntervalSince1970: interval)
+        return withConfiguration { configuration in
+            guard let cTimeZone = configuration.cTimeZone else {
+                var validCount = 0
+                validity.initialize(repeating: 0)
+                for i in 0..<count {
+                    let bytes = UnsafeRawBufferPointer(rebasing: buffer[Int(offsets[i])..<Int(offsets[i + 1])])
+                    let string = String(decoding: bytes, as: UTF8.self)
+                    if !string.isEmpty, !configuration.formatOptions.isEmpty, let date = configuration.fallbackFormatter?.date(from: string) {
+                        results[i] = date.timeIntervalSince1970
+                        validity[i >> 3] |= 1 << (i & 7)
+                        validCount += 1
+                    } else {
+                        results[i] = 0
+                    }
+                }
+                return validCount
+            }
+            
+            let validCount = JJLTimeIntervalsForStrings(
+                buffer.baseAddress?.assumingMemoryBound(to: CChar.self),
+                offsets.baseAddress,
+                Int32(count),
+                configuration.formatPlan,
+                cTimeZone,
+                results.baseAddress,
+                validity.baseAddress
+            )
+            return Int(validCount)
+        }
     }
     
     /// Returns a string representation of the specified date using the provided time zone and format options.
     public static func string(from date: Date, timeZone: TimeZone, formatOptions: ISO8601DateFormatter.Options) -> String {
         performInitialSetupIfNecessary()
-        let cTimeZone = Self.cTimeZone(for: timeZone, alwaysUseNSTimeZone: false)
-        return stringFromDate(date, formatOptions: formatOptions, cTimeZone: cTimeZone, timeZone: timeZone)
+        // Pinned just for this call, which doesn't allocate like making a TimeZoneHandle would
+        let handle = acquireHandle(for: timeZone)
+        defer { JJLReleaseTimeZoneHandle(handle) }
+        let cTimeZone = JJLTimeZoneForHandle(handle)
+        if cTimeZone == nil {
+            warnAboutMissingTimeZone(timeZone)
+        }
+        let options = CFISO8601DateFormatOptions(rawValue: UInt(formatOptions.rawValue))
+        return stringFromDate(date, cTimeZone: cTimeZone, timeZone: timeZone, maxLength: Int(kJJLMaxDateLength)) { buffer, time, offset in
+            JJLFillBufferForDate(buffer, time, options, cTimeZone, offset)
+        }
+    }
+
+    /// Same as `string(from:timeZone:formatOptions:)`, but with the time zone already looked up.
+    public static func string(from date: Date, timeZoneHandle: TimeZoneHandle, formatOptions: ISO8601DateFormatter.Options) -> String {
+        let cTimeZone = timeZoneHandle.cTimeZone
+        let options = CFISO8601DateFormatOptions(rawValue: UInt(formatOptions.rawValue))
+        return stringFromDate(date, cTimeZone: cTimeZone, timeZone: gmtTimeZone, maxLength: Int(kJJLMaxDateLength)) { buffer, time, offset in
+            JJLFillBufferForDate(buffer, time, options, cTimeZone, offset)
+        }
+    }
+
+    /// Formats many dates at once. Equivalent to calling `string(from:)` on each date, but the format options and
+    /// time zone are resolved once for the whole batch.
+    public func strings(from dates: [Date]) -> [String] {
+        // In batches, since offsets are 32-bit, and so the buffer stays small however many dates there are
+        let batchSize = 65_536
+        var strings: [String] = []
+        strings.reserveCapacity(dates.count)
+        var offsets = [Int32](repeating: 0, count: min(dates.count, batchSize) + 1)
+        var bytes = [UInt8](repeating: 0, count: min(dates.count, batchSize) * Int(kJJLMaxDateLength))
+        withConfiguration { configuration in
+            for start in stride(from: 0, to: dates.count, by: batchSize) {
+                let timeIntervals = dates[start..<min(start + batchSize, dates.count)].map { $0.timeIntervalSince1970 }
+                bytes.withUnsafeMutableBufferPointer { buffer in
+                    offsets.withUnsafeMutableBufferPointer { offsetsBuffer in
+                        timeIntervals.withUnsafeBufferPointer { timeIntervalsBuffer in
+                            _ = Self.fillBuffer(buffer, offsets: offsetsBuffer, timeIntervalsSince1970: timeIntervalsBuffer, configuration: configuration)
+                        }
+                    }
+                }
+                for i in 0..<timeIntervals.count {
+                    strings.append(String(decoding: bytes[Int(offsets[i])..<Int(offsets[i + 1])], as: UTF8.self))
+                }
+            }
+        }
+        return strings
     }
     
-    @inline(__always)
-    private static func stringFromDate(
-        _ date: Date,
-        formatOptions: ISO8601DateFormatter.Options,
-        cTimeZone: timezone_t?,
-        timeZone: TimeZone
-    ) -> String {
-        let time = date.timeIntervalSince1970
+    /// Formats `timeIntervals` (seconds since 1970) back to back into `buffer`, without NUL terminators, and fills
+    /// `offsets` Arrow-style, so that string `i` is `buffer[offsets[i]..<offsets[i + 1]]`.
+    ///
+    /// `buffer` must have room for the longest string that the format options can produce for each date
+    /// (`timeIntervals.count * kJJLMaxDateLength` bytes is always enough) and `offsets` must hold at least
+    /// `timeIntervals.count + 1` entries. Since the offsets are 32-bit, that room can't be more than `Int32.max` bytes,
+    /// i.e. a batch can be at most tens of millions of dates, so split larger ones. Returns the total number of bytes written.
+    public func fillBuffer(
+        _ buffer: UnsafeMutableBufferPointer<UInt8>,
+        offsets: UnsafeMutableBufferPointer<Int32>,
+        timeIntervalsSince1970 timeIntervals: UnsafeBufferPointer<Double>
+    ) -> Int {
+        return withConfiguration { configuration in
+            Self.fillBuffer(buffer, offsets: offsets, timeIntervalsSince1970: timeIntervals, configuration: configuration)
+        }
+    }
+    
+    private static func fillBuffer(
+        _ buffer: UnsafeMutableBufferPointer<UInt8>,
+        offsets: UnsafeMutableBufferPointer<Int32>,
+        timeIntervalsSince1970 timeIntervals: UnsafeBufferPointer<Double>,
+        configuration: Configuration
+    ) -> Int {
+        precondition(offsets.count > timeIntervals.count, "offsets must have room for timeIntervals.count + 1 entries")
+        guard let bufferStart = buffer.baseAddress, let offsetsStart = offsets.baseAddress else {
+            return 0
+        }
+        let formatPlan = configuration.formatPlan
+        let (maxBytes, overflow) = timeIntervals.count.multipliedReportingOverflow(by: Int(JJLMaxLengthForFormatPlan(formatPlan)))
+        precondition(!overflow && maxBytes <= Int(Int32.max) && timeIntervals.count < Int(Int32.max), "the batch is too large for 32-bit offsets")
+        precondition(buffer.count >= maxBytes, "buffer is too small for the batch")
+        let written = bufferStart.withMemoryRebound(to: CChar.self, capacity: buffer.count) { cBuffer -> Int32 in
+            if let cTimeZone = configuration.cTimeZone {
+                return JJLFillBufferForDates(cBuffer, timeIntervals.baseAddress, Int32(timeIntervals.count), formatPlan, cTimeZone, nil, offsetsStart)
+            }
+            // The fallback offset depends on the date, so it has to be computed for each one
+            let fallbackOffsets = timeIntervals.map { fallbackOffset(for: Date(timeIntervalSince1970: $0), timeZone: configuration.timeZone) }
+            return JJLFillBufferForDates(cBuffer, timeIntervals.baseAddress, Int32(timeIntervals.count), formatPlan, nil, fallbackOffsets, offsetsStart)
+        }
+        return Int(written)
+    }
+    
+    /// The offset to pass to the C formatting code when there is no C time zone.
+    private static func fallbackOffset(for date: Date, timeZone: TimeZone) -> Double {
         // When using fallback (cTimeZone is nil), we need to determine if this is a
         // synthetic GMT offset timezone (like TimeZone(secondsFromGMT:)) or a real
         // historical timezone. Synthetic timezones have identifiers like "GMT+0800"
         // and should be truncated to minute precision to match Apple's behavior.
         // Real timezones (like Africa/Monrovia) can have second-precision offsets.
-        let offset: Double
-        if cTimeZone != nil {
-            offset = 0
+        let rawOffset = timeZone.secondsFromGMT(for: date)
+        // Check if this is a synthetic GMT offset timezone by examining the identifier
+        // Synthetic timezones have identifiers like "GMT+0800" or "GMT-0530"
+        let identifier = timeZone.identifier
+        if identifier.hasPrefix("GMT+") || identifier.hasPrefix("GMT-") {
+            // Truncate to minute precision for synthetic GMT offset timezones
+            return Double((rawOffset / 60) * 60)
         } else {
-            let rawOffset = timeZone.secondsFromGMT(for: date)
-            // Check if this is a synthetic GMT offset timezone by examining the identifier
-            // Synthetic timezones have identifiers like "GMT+0800" or "GMT-0530"
-            let identifier = timeZone.identifier
-            if identifier.hasPrefix("GMT+") || identifier.hasPrefix("GMT-") {
-                // Truncate to minute precision for synthetic GMT offset timezones
-                offset = Double((rawOffset / 60) * 60)
-            } else {
-                // Real timezone - preserve full precision including seconds
-                offset = Double(rawOffset)
+            // Real timezone - preserve full precision including seconds
+            return Double(rawOffset)
+        }
+    }
+    
+    /// `fill` writes the date into the buffer it's given, which has room for `maxLength` bytes, and returns the length.
+    @inline(__always)
+    private static func stringFromDate(
+        _ date: Date,
+        cTimeZone: timezone_t?,
+        timeZone: TimeZone,
+        maxLength: Int,
+        fill: (UnsafeMutablePointer<CChar>, TimeInterval, Double) -> Int32
+    ) -> String {
+        guard maxLength > 0 else {
+            // Nothing gets written for these options
+            return ""
+        }
+        let time = date.timeIntervalSince1970
+        let offset = cTimeZone != nil ? 0 : fallbackOffset(for: date, timeZone: timeZone)
+        if #available(macOS 11.0, iOS 14.0, tvOS 14.0, watchOS 7.0, *) {
+            // The C code writes straight into the string's own storage, which is inline (no allocation at all) when
+            // maxLength fits in a small string
+            return String(unsafeUninitializedCapacity: maxLength) { buffer in
+                return buffer.withMemoryRebound(to: CChar.self) { cBuffer in
+                    return Int(fill(cBuffer.baseAddress!, time, offset))
+                }
             }
         }
-        return withUnsafeTemporaryAllocation(of: CChar.self, capacity: Int(kJJLMaxDateLength)) { buffer in
-            buffer.initialize(repeating: 0)
-            
-            JJLFillBufferForDate(
-                buffer.baseAddress,
-                time,
-                CFISO8601DateFormatOptions(rawValue: UInt(formatOptions.rawValue)),
-                cTimeZone,
-                offset
-            )
-            
-            return String(cString: buffer.baseAddress!)
+        return withUnsafeTemporaryAllocation(of: CChar.self, capacity: maxLength) { buffer in
+            let length = Int(fill(buffer.baseAddress!, time, offset))
+            return String(decoding: UnsafeRawBufferPointer(start: buffer.baseAddress!, count: length), as: UTF8.self)
         }
     }
     
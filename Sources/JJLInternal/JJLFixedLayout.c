@@ -0,0 +1,276 @@
+//Copyright (c) 2018 Michael Eisel. All rights reserved.
+
+#import <string.h>
+
+#import "JJLFixedLayout.h"
+
+#if defined(__x86_64__)
+#import <immintrin.h>
+#endif
+
+// Builds a little-endian 64-bit word out of 8 bytes, given in string order
+#define JJL_BYTES8(a, b, c, d, e, f, g, h) \
+    ((uint64_t)(uint8_t)(a) | (uint64_t)(uint8_t)(b) << 8 | (uint64_t)(uint8_t)(c) << 16 | (uint64_t)(uint8_t)(d) << 24 | \
+     (uint64_t)(uint8_t)(e) << 32 | (uint64_t)(uint8_t)(f) << 40 | (uint64_t)(uint8_t)(g) << 48 | (uint64_t)(uint8_t)(h) << 56)
+#define JJL_REPEAT_BYTE(b) (0x0101010101010101ULL * (uint8_t)(b))
+
+static inline bool JJLIsDigit(char c) {
+    return (unsigned char)(c - '0') <= 9;
+}
+
+static inline int32_t JJLTwoDigits(const char *string) {
+    return (string[0] - '0') * 10 + (string[1] - '0');
+}
+
+// Everything after the seconds is short and variable, so it's handled with plain scalar code
+static inline bool JJLParseFixedLayoutTail(const char *string, int32_t length, bool hasFractionalSeconds, JJLFixedLayoutFields *fields) {
+    int32_t position = 19;
+    fields->millis = 0;
+    if (hasFractionalSeconds) {
+        if (length < 24 || (string[19] != '.' && string[19] != ',') || !JJLIsDigit(string[20]) || !JJLIsDigit(string[21]) || !JJLIsDigit(string[22])) {
+            return false;
+        }
+        fields->millis = (string[20] - '0') * 100 + JJLTwoDigits(string + 21);
+        position = 23;
+    }
+    const char *timeZone = string + position;
+    if (length == position + 1) {
+        fields->timeZoneOffset = 0;
+        return timeZone[0] == 'Z';
+    }
+    if (length != position + 6) {
+        return false;
+    }
+    char sign = timeZone[0];
+    if ((sign != '+' && sign != '-') || !JJLIsDigit(timeZone[1]) || !JJLIsDigit(timeZone[2]) || timeZone[3] != ':' || !JJLIsDigit(timeZone[4]) || !JJLIsDigit(timeZone[5])) {
+        return false;
+    }
+    int32_t offset = JJLTwoDigits(timeZone + 1) * 60 * 60 + JJLTwoDigits(timeZone + 4) * 60;
+    fields->timeZoneOffset = sign == '-' ? -offset : offset;
+    return true;
+}
+
+// Out-of-range months are left to the scalar parser so that the behavior for them stays exactly the same
+static inline bool JJLIsValidMonth(int32_t month) {
+    return 1 <= month && month <= 12;
+}
+
+#pragma mark - SWAR
+
+// The date part is checked 8 bytes at a time, as "yyyy-MM-", "ddTHH:mm" and (overlapping) "HH:mm:ss". Each chunk is
+// XORed with a template that has '0' at digit positions and the separator elsewhere, so that digits become their
+// values and matching separators become 0. Then every byte just has to be at most its limit: 9 or 0, respectively.
+static const uint64_t kJJLDateTemplate = JJL_BYTES8('0', '0', '0', '0', '-', '0', '0', '-');
+static const uint64_t kJJLDateLimits = JJL_BYTES8(9, 9, 9, 9, 0, 9, 9, 0);
+static const uint64_t kJJLDayTemplate = JJL_BYTES8('0', '0', 0 /* date-time separator */, '0', '0', ':', '0', '0');
+static const uint64_t kJJLTimeTemplate = JJL_BYTES8('0', '0', ':', '0', '0', ':', '0', '0');
+static const uint64_t kJJLTimeLimits = JJL_BYTES8(9, 9, 0, 9, 9, 0, 9, 9);
+
+static inline uint64_t JJLLoad64(const char *string) {
+    uint64_t value;
+    memcpy(&value, string, sizeof(value));
+    return value;
+}
+
+static inline bool JJLIsWithinLimits(uint64_t values, uint64_t limits) {
+    // A byte's high bit gets set if it's over its limit. Bytes that are >= 0x80 to begin with are caught by the OR,
+    // and for all other bytes the addition can't carry into the next one
+    uint64_t overLimit = (values + (JJL_REPEAT_BYTE(0x7F) - limits)) | values;
+    return (overLimit & JJL_REPEAT_BYTE(0x80)) == 0;
+}
+
+static inline uint64_t JJLDigitPairs(uint64_t digits) {
+    // Byte i becomes 10 * digit i + digit i + 1, which is at most 99, so nothing carries
+    return digits * 10 + (digits >> 8);
+}
+
+static inline int32_t JJLByteAt(uint64_t word, int32_t index) {
+    return (int32_t)((word >> (index * 8)) & 0xFF);
+}
+
+static bool JJLParseFixedLayoutSWAR(const char *string, int32_t length, char dateTimeSeparator, bool hasFractionalSeconds, JJLFixedLayoutFields *fields) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (length < 20) {
+        return false;
+    }
+    uint64_t date = JJLLoad64(string) ^ kJJLDateTemplate;
+    uint64_t day = JJLLoad64(string + 8) ^ (kJJLDayTemplate | (uint64_t)(uint8_t)dateTimeSeparator << 16);
+    uint64_t time = JJLLoad64(string + 11) ^ kJJLTimeTemplate;
+    if (!JJLIsWithinLimits(date, kJJLDateLimits) || !JJLIsWithinLimits(day, kJJLTimeLimits) || !JJLIsWithinLimits(time, kJJLTimeLimits)) {
+        return false;
+    }
+    uint64_t datePairs = JJLDigitPairs(date);
+    uint64_t timePairs = JJLDigitPairs(time);
+    fields->year = JJLByteAt(datePairs, 0) * 100 + JJLByteAt(datePairs, 2);
+    fields->month = JJLByteAt(datePairs, 5);
+    fields->day = JJLByteAt(JJLDigitPairs(day), 0);
+    fields->hour = JJLByteAt(timePairs, 0);
+    fields->minute = JJLByteAt(timePairs, 3);
+    fields->second = JJLByteAt(timePairs, 6);
+    return JJLIsValidMonth(fields->month) && JJLParseFixedLayoutTail(string, length, hasFractionalSeconds, fields);
+#else
+    return false;
+#endif
+}
+
+// Everything after the seconds (or fractional seconds) for formatting, i.e. the time zone
+static inline int32_t JJLFormatFixedLayoutTail(char *buffer, int32_t position, int32_t timeZoneOffset) {
+    char *timeZone = buffer + position;
+    if (timeZoneOffset == 0) {
+        timeZone[0] = 'Z';
+        return position + 1;
+    }
+    int32_t offset = timeZoneOffset < 0 ? -timeZoneOffset : timeZoneOffset;
+    int32_t hours = offset / (60 * 60);
+    int32_t minutes = offset % (60 * 60) / 60;
+    int32_t seconds = offset % 60;
+    timeZone[0] = timeZoneOffset < 0 ? '-' : '+';
+    timeZone[1] = '0' + hours / 10;
+    timeZone[2] = '0' + hours % 10;
+    timeZone[3] = ':';
+    timeZone[4] = '0' + minutes / 10;
+    timeZone[5] = '0' + minutes % 10;
+    if (seconds == 0) {
+        return position + 6;
+    }
+    timeZone[6] = ':';
+    timeZone[7] = '0' + seconds / 10;
+    timeZone[8] = '0' + seconds % 10;
+    return position + 9;
+}
+
+static inline void JJLStore64(char *buffer, uint64_t value) {
+    memcpy(buffer, &value, sizeof(value));
+}
+
+// Converts four numbers in [0, 99], one per 16-bit lane, into their two ASCII digits (tens in the low byte, i.e. first
+// in string order). n * 103 >> 10 is n / 10 for all n <= 99, and the product never leaves its lane.
+static inline uint64_t JJLASCIIPairs(uint64_t numbers) {
+    uint64_t tens = ((numbers * 103) >> 10) & 0x000F000F000F000FULL;
+    uint64_t ones = numbers - tens * 10;
+    return tens | (ones << 8) | 0x3030303030303030ULL;
+}
+
+static inline uint64_t JJLPairAt(uint64_t pairs, int32_t index) {
+    return (pairs >> (index * 16)) & 0xFFFF;
+}
+
+static int32_t JJLFormatFixedLayoutSWAR(char *buffer, char dateTimeSeparator, bool hasFractionalSeconds, const JJLFixedLayoutFields *fields) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t date = JJLASCIIPairs((uint64_t)(fields->year / 100) | (uint64_t)(fields->year % 100) << 16 | (uint64_t)fields->month << 32 | (uint64_t)fields->day << 48);
+    uint64_t time = JJLASCIIPairs((uint64_t)fields->hour | (uint64_t)fields->minute << 16 | (uint64_t)fields->second << 32 | (uint64_t)(fields->millis % 100) << 48);
+    // "yyyy-MM-", "ddTHH:mm" and then "HH:mm:ss", overlapping the previous store
+    JJLStore64(buffer, JJLPairAt(date, 0) | JJLPairAt(date, 1) << 16 | (uint64_t)'-' << 32 | JJLPairAt(date, 2) << 40 | (uint64_t)'-' << 56);
+    JJLStore64(buffer + 8, JJLPairAt(date, 3) | (uint64_t)(uint8_t)dateTimeSeparator << 16 | JJLPairAt(time, 0) << 24 | (uint64_t)':' << 40 | JJLPairAt(time, 1) << 48);
+    JJLStore64(buffer + 11, JJLPairAt(time, 0) | (uint64_t)':' << 16 | JJLPairAt(time, 1) << 24 | (uint64_t)':' << 40 | JJLPairAt(time, 2) << 48);
+    if (!hasFractionalSeconds) {
+        return JJLFormatFixedLayoutTail(buffer, 19, fields->timeZoneOffset);
+    }
+    // "m:ss.SSS"
+    uint64_t millisHundreds = (uint64_t)('0' + fields->millis / 100);
+    JJLStore64(buffer + 15, (JJLPairAt(time, 1) >> 8) | (uint64_t)':' << 8 | JJLPairAt(time, 2) << 16 | (uint64_t)'.' << 32 | millisHundreds << 40 | JJLPairAt(time, 3) << 48);
+    return JJLFormatFixedLayoutTail(buffer, 23, fields->timeZoneOffset);
+#else
+    char *start = buffer;
+    int32_t values[] = {fields->year / 100, fields->year % 100, fields->month, fields->day, fields->hour, fields->minute, fields->second};
+    const char separators[] = {0, '-', '-', dateTimeSeparator, ':', ':', 0};
+    for (int32_t i = 0; i < 7; i++) {
+        *buffer++ = '0' + values[i] / 10;
+        *buffer++ = '0' + values[i] % 10;
+        if (separators[i]) {
+            *buffer++ = separators[i];
+        }
+    }
+    if (hasFractionalSeconds) {
+        *buffer++ = '.';
+        *buffer++ = '0' + fields->millis / 100;
+        *buffer++ = '0' + fields->millis / 10 % 10;
+        *buffer++ = '0' + fields->millis % 10;
+    }
+    return JJLFormatFixedLayoutTail(start, (int32_t)(buffer - start), fields->timeZoneOffset);
+#endif
+}
+
+#pragma mark - SSE4.1
+
+#if defined(__x86_64__)
+
+// Same idea as the SWAR version, but the first 19 bytes are covered by two overlapping 16-byte loads,
+// "yyyy-MM-ddTHH:mm" and "y-MM-ddTHH:mm:ss", and the digits are gathered and combined into pairs with one shuffle
+// and one multiply-add. AVX2 wouldn't help here: a 32-byte load would run past the end of a 20-byte string.
+__attribute__((target("sse4.1")))
+static bool JJLParseFixedLayoutSSE41(const char *string, int32_t length, char dateTimeSeparator, bool hasFractionalSeconds, JJLFixedLayoutFields *fields) {
+    if (length < 20) {
+        return false;
+    }
+    __m128i headTemplate = _mm_insert_epi8(_mm_setr_epi8('0', '0', '0', '0', '-', '0', '0', '-', '0', '0', 0, '0', '0', ':', '0', '0'), dateTimeSeparator, 10);
+    __m128i tailTemplate = _mm_insert_epi8(_mm_setr_epi8('0', '-', '0', '0', '-', '0', '0', 0, '0', '0', ':', '0', '0', ':', '0', '0'), dateTimeSeparator, 7);
+    __m128i head = _mm_xor_si128(_mm_loadu_si128((const __m128i *)string), headTemplate);
+    __m128i tail = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(string + 3)), tailTemplate);
+    __m128i headLimits = _mm_setr_epi8(9, 9, 9, 9, 0, 9, 9, 0, 9, 9, 0, 9, 9, 0, 9, 9);
+    __m128i tailLimits = _mm_setr_epi8(9, 0, 9, 9, 0, 9, 9, 0, 9, 9, 0, 9, 9, 0, 9, 9);
+    __m128i overLimit = _mm_or_si128(_mm_subs_epu8(head, headLimits), _mm_subs_epu8(tail, tailLimits));
+    if (!_mm_testz_si128(overLimit, overLimit)) {
+        return false;
+    }
+    // Gather yyyyMMddHHmm from the head and ss from the tail
+    __m128i headDigits = _mm_shuffle_epi8(head, _mm_setr_epi8(0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, -1, -1, -1, -1));
+    __m128i tailDigits = _mm_shuffle_epi8(tail, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 14, 15, -1, -1));
+    // 10 * even byte + odd byte, giving yy, yy, MM, dd, HH, mm, ss as 16-bit lanes
+    __m128i pairs = _mm_maddubs_epi16(_mm_or_si128(headDigits, tailDigits), _mm_set1_epi16(0x010A));
+    fields->year = _mm_extract_epi16(pairs, 0) * 100 + _mm_extract_epi16(pairs, 1);
+    fields->month = _mm_extract_epi16(pairs, 2);
+    fields->day = _mm_extract_epi16(pairs, 3);
+    fields->hour = _mm_extract_epi16(pairs, 4);
+    fields->minute = _mm_extract_epi16(pairs, 5);
+    fields->second = _mm_extract_epi16(pairs, 6);
+    return JJLIsValidMonth(fields->month) && JJLParseFixedLayoutTail(string, length, hasFractionalSeconds, fields);
+}
+
+// All eight two-digit numbers are split into digits at once (multiplying by 6554 and keeping the high half is a
+// division by 10 for anything under 16384), then shuffled into place between the separators. The date and time are
+// written with two overlapping 16-byte stores that end exactly at the end of the seconds (or fractional seconds).
+__attribute__((target("sse4.1")))
+static int32_t JJLFormatFixedLayoutSSE41(char *buffer, char dateTimeSeparator, bool hasFractionalSeconds, const JJLFixedLayoutFields *fields) {
+    __m128i numbers = _mm_setr_epi16(fields->year / 100, fields->year % 100, fields->month, fields->day, fields->hour, fields->minute, fields->second, fields->millis % 100);
+    __m128i tens = _mm_mulhi_epu16(numbers, _mm_set1_epi16(6554));
+    __m128i ones = _mm_sub_epi16(numbers, _mm_mullo_epi16(tens, _mm_set1_epi16(10)));
+    // Byte pairs of yy, yy, MM, dd, HH, mm, ss, SS (the last two digits of the milliseconds)
+    __m128i digits = _mm_or_si128(_mm_or_si128(tens, _mm_slli_epi16(ones, 8)), _mm_set1_epi8('0'));
+    // "yyyy-MM-ddTHH:mm"
+    __m128i headTemplate = _mm_insert_epi8(_mm_setr_epi8(0, 0, 0, 0, '-', 0, 0, '-', 0, 0, 0, 0, 0, ':', 0, 0), dateTimeSeparator, 10);
+    __m128i head = _mm_or_si128(_mm_shuffle_epi8(digits, _mm_setr_epi8(0, 1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10, 11)), headTemplate);
+    _mm_storeu_si128((__m128i *)buffer, head);
+    if (!hasFractionalSeconds) {
+        // "y-MM-ddTHH:mm:ss"
+        __m128i tailTemplate = _mm_insert_epi8(_mm_setr_epi8(0, '-', 0, 0, '-', 0, 0, 0, 0, 0, ':', 0, 0, ':', 0, 0), dateTimeSeparator, 7);
+        __m128i tail = _mm_or_si128(_mm_shuffle_epi8(digits, _mm_setr_epi8(3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13)), tailTemplate);
+        _mm_storeu_si128((__m128i *)(buffer + 3), tail);
+        return JJLFormatFixedLayoutTail(buffer, 19, fields->timeZoneOffset);
+    }
+    // "-ddTHH:mm:ss.SSS", where the hundreds digit of the milliseconds goes in separately
+    __m128i tailTemplate = _mm_insert_epi8(_mm_setr_epi8('-', 0, 0, 0, 0, 0, ':', 0, 0, ':', 0, 0, '.', 0, 0, 0), dateTimeSeparator, 3);
+    __m128i tail = _mm_or_si128(_mm_shuffle_epi8(digits, _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, -1, 14, 15)), tailTemplate);
+    tail = _mm_insert_epi8(tail, '0' + fields->millis / 100, 13);
+    _mm_storeu_si128((__m128i *)(buffer + 7), tail);
+    return JJLFormatFixedLayoutTail(buffer, 23, fields->timeZoneOffset);
+}
+
+#endif
+
+#pragma mark - Dispatch
+
+JJLFixedLayoutParseFunction JJLParseFixedLayout = JJLParseFixedLayoutSWAR;
+JJLFixedLayoutFormatFunction JJLFormatFixedLayout = JJLFormatFixedLayoutSWAR;
+
+void JJLSetUpFixedLayoutKernels(void) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.1")) {
+        JJLParseFixedLayout = JJLParseFixedLayoutSSE41;
+        JJLFormatFixedLayout = JJLFormatFixedLayoutSSE41;
+        return;
+    }
+#endif
+    JJLParseFixedLayout = JJLParseFixedLayoutSWAR;
+    JJLFormatFixedLayout = JJLFormatFixedLayoutSWAR;
+}
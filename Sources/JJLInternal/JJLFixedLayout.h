@@ -0,0 +1,41 @@
+//Copyright (c) 2018 Michael Eisel. All rights reserved.
+
+#ifndef JJLFixedLayout_h
+#define JJLFixedLayout_h
+
+#import <stdbool.h>
+#import <stdint.h>
+
+// Vectorized kernels for the one layout that the default options (internet date time, optionally with fractional
+// seconds) always produce: "yyyy-MM-ddTHH:mm:ss[.SSS](Z|+HH:mm|-HH:mm)", i.e. 20, 24, 25 or 29 bytes. When parsing,
+// anything that doesn't match it exactly is rejected, and the caller falls back to the general scalar code.
+
+typedef struct {
+    int32_t year;
+    int32_t month; // 1-based
+    int32_t day;
+    int32_t hour;
+    int32_t minute;
+    int32_t second;
+    int32_t millis;
+    int32_t timeZoneOffset; // In seconds
+} JJLFixedLayoutFields;
+
+// Returns false if the string isn't exactly in the fixed layout
+typedef bool (*JJLFixedLayoutParseFunction)(const char *string, int32_t length, char dateTimeSeparator, bool hasFractionalSeconds, JJLFixedLayoutFields *fields);
+
+// The best parser for this CPU. It's the portable SWAR one until JJLSetUpFixedLayoutKernels has run.
+extern JJLFixedLayoutParseFunction JJLParseFixedLayout;
+
+// Writes the fields in the fixed layout, without a NUL terminator, and returns the number of bytes written. The year
+// must be in [0, 9999] and the offset under 100 hours; an offset with a seconds component gets a trailing ":ss",
+// like the scalar formatter does. Nothing past the returned length is written.
+typedef int32_t (*JJLFixedLayoutFormatFunction)(char *buffer, char dateTimeSeparator, bool hasFractionalSeconds, const JJLFixedLayoutFields *fields);
+
+// The best formatter for this CPU. It's the portable SWAR one until JJLSetUpFixedLayoutKernels has run.
+extern JJLFixedLayoutFormatFunction JJLFormatFixedLayout;
+
+// Picks the kernels to use based on what the CPU supports
+void JJLSetUpFixedLayoutKernels(void);
+
+#endif /* JJLFixedLayout_h */
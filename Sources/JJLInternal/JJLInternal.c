@@ -12,6 +12,7 @@
 #import <dispatch/dispatch.h>
 
 #import "JJLInternal.h"
+#import "JJLFixedLayout.h"
 
 static bool sIsIOS11OrHigher = false;
 static timezone_t sGMTTimeZone = NULL;
@@ -41,6 +42,7 @@ void JJLPerformInitialSetup() {
         }
     }
     sGMTTimeZone = jjl_tzalloc("GMT");
+    JJLSetUpFixedLayoutKernels();
 }
 
 static inline void JJLPushBuffer(char **string, char *newBuffer, int32_t size) {
@@ -59,16 +61,30 @@ static inline void JJLPushNumber(char **string, int32_t num, int32_t fixedDigitL
     }
 }
 
-static inline void JJLFillBufferWithFractionalSeconds(double time, char **string) {
+// kJJLPowersOfTen[i] is 10^i, for scaling between nanoseconds and a number of fractional digits
+static const int32_t kJJLPowersOfTen[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+// The fractional part of the time rounded to the given number of digits, in nanoseconds
+static inline int32_t JJLNanosecondsForTime(double time, int32_t digits) {
     double unused = 0;
     double fractionalComponent = modf(time, &unused);
     // Handle negative fractional component for dates before 1970
     if (fractionalComponent < 0) {
         fractionalComponent += 1.0;
     }
-    int32_t millis = (int32_t)lround(fractionalComponent * 1000);
-    if (millis == 1000) millis = 999; // Avoid overflow from rounding
-    JJLPushNumber(string, millis, 3);
+    int32_t fraction = (int32_t)lround(fractionalComponent * kJJLPowersOfTen[digits]);
+    if (fraction == kJJLPowersOfTen[digits]) fraction--; // Avoid overflow from rounding
+    return fraction * kJJLPowersOfTen[9 - digits];
+}
+
+// Writes the first digits of the nanoseconds, i.e. truncates them to that precision. All 9 digits are looked up, 3 at a time, and then
+// only the ones needed are copied, since that's branch-free and cheaper than dividing down first
+static inline void JJLPushFractionalSeconds(char **string, int32_t nanoseconds, int32_t digits) {
+    char all[9];
+    memcpy(all, &sItoaStrings[nanoseconds / 1000000][1], 3);
+    memcpy(all + 3, &sItoaStrings[nanoseconds / 1000 % 1000][1], 3);
+    memcpy(all + 6, &sItoaStrings[nanoseconds % 1000][1], 3);
+    JJLPushBuffer(string, all, digits);
 }
 
 static inline int32_t JJLDaysInYear(int32_t year) {
@@ -85,136 +101,547 @@ static bool JJLGetShowFractionalSeconds(CFISO8601DateFormatOptions options)
     }
 }
 
-void JJLFillBufferForDate(char *buffer, double timeInSeconds, CFISO8601DateFormatOptions options, timezone_t timeZone, double fallbackOffset) {
-    if ((options & (options - 1)) == 0) {
+// The format options, decoded into the components they turn on. This is done once, when compiling a JJLFormatPlan,
+// rather than re-deriving each flag wherever it's needed.
+typedef struct {
+    bool isEmpty;
+    bool showFractionalSeconds;
+    // How many digits of fractional seconds are written and read, in [1, 9], if they're shown
+    int32_t fractionalSecondDigits;
+    bool showYear;
+    bool showDateSeparator;
+    bool showMonth;
+    bool showDay;
+    bool showWeekOfYear;
+    bool showDate;
+    bool showTime;
+    bool showTimeSeparator;
+    bool timeSeparatorIsSpace;
+    bool showTimeZone;
+    bool showColonSeparatorInTimeZone;
+    // Internet date time, possibly with fractional seconds and/or a space between date and time, which has a fixed layout
+    bool isFixedLayout;
+} JJLFormatComponents;
+
+static inline void JJLDecodeFormatOptions(CFISO8601DateFormatOptions options, int32_t fractionalSecondDigits, JJLFormatComponents *c) {
+    // Zero or one options produces nothing
+    c->isEmpty = (options & (options - 1)) == 0;
+    c->showFractionalSeconds = JJLGetShowFractionalSeconds(options) && fractionalSecondDigits > 0;
+    c->fractionalSecondDigits = c->showFractionalSeconds ? fractionalSecondDigits : 0;
+    c->showYear = !!(options & kCFISO8601DateFormatWithYear);
+    c->showDateSeparator = !!(options & kCFISO8601DateFormatWithDashSeparatorInDate);
+    c->showMonth = !!(options & kCFISO8601DateFormatWithMonth);
+    c->showDay = !!(options & kCFISO8601DateFormatWithDay);
+    bool isInternetDateTime = (options & kCFISO8601DateFormatWithInternetDateTime) == kCFISO8601DateFormatWithInternetDateTime;
+    // For some reason, the week of the year is never shown if all the components of internet date time are shown
+    c->showWeekOfYear = !isInternetDateTime && !!(options & kCFISO8601DateFormatWithWeekOfYear);
+    c->showDate = c->showYear || c->showMonth || c->showDay || c->showWeekOfYear;
+    c->showTime = !!(options & kCFISO8601DateFormatWithTime);
+    c->showTimeSeparator = !!(options & kCFISO8601DateFormatWithColonSeparatorInTime);
+    c->timeSeparatorIsSpace = !!(options & kCFISO8601DateFormatWithSpaceBetweenDateAndTime);
+    c->showTimeZone = !!(options & kCFISO8601DateFormatWithTimeZone);
+    c->showColonSeparatorInTimeZone = !!(options & kCFISO8601DateFormatWithColonSeparatorInTimeZone);
+    CFISO8601DateFormatOptions layoutOptions = options & ~(kCFISO8601DateFormatWithFractionalSeconds | kCFISO8601DateFormatWithSpaceBetweenDateAndTime);
+    // The fixed layout only has room for milliseconds
+    c->isFixedLayout = layoutOptions == kCFISO8601DateFormatWithInternetDateTime && (!c->showFractionalSeconds || c->fractionalSecondDigits == 3);
+}
+
+typedef enum {
+    JJLFormatFieldYear,
+    JJLFormatFieldMonth,
+    JJLFormatFieldWeekOfYear, // Including the 'W'
+    JJLFormatFieldDayOfMonth,
+    JJLFormatFieldDayOfWeek,
+    JJLFormatFieldDayOfYear,
+    JJLFormatFieldHour,
+    JJLFormatFieldMinute,
+    JJLFormatFieldSecond,
+    JJLFormatFieldFractionalSeconds, // Including the '.'
+    JJLFormatFieldTimeZone,
+} JJLFormatField;
+
+typedef struct {
+    uint8_t field;
+    // Written before the field, or '\0' for none
+    char separator;
+    // When parsing, whether the separator has to match exactly, rather than being any of ' ', '-' or ':'
+    bool separatorIsExact;
+} JJLFormatOp;
+
+static const int32_t kJJLMaxFormatOps = 9;
+
+// The format options compiled into the fields to write or read, in order, so that the per-date code doesn't have to
+// work out which fields are shown and which separators go between them
+struct JJLFormatPlan {
+    JJLFormatComponents components;
+    int32_t opCount;
+    int32_t maxLength;
+    JJLFormatOp ops[kJJLMaxFormatOps];
+};
+
+static inline void JJLAddFormatOp(JJLFormatPlan *plan, JJLFormatField field, char separator, bool separatorIsExact, int32_t maxFieldLength) {
+    plan->ops[plan->opCount++] = (JJLFormatOp){ .field = field, .separator = separator, .separatorIsExact = separatorIsExact };
+    plan->maxLength += maxFieldLength + (separator ? 1 : 0);
+}
+
+static void JJLCompileFormatPlan(CFISO8601DateFormatOptions options, int32_t fractionalSecondDigits, JJLFormatPlan *plan) {
+    JJLFormatComponents *c = &plan->components;
+    JJLDecodeFormatOptions(options, fractionalSecondDigits, c);
+    plan->opCount = 0;
+    plan->maxLength = 0;
+    if (c->isEmpty) {
         return;
     }
-    struct tm components = {0};
+    char dateSeparator = c->showDateSeparator ? '-' : '\0';
+    if (c->showYear) {
+        JJLAddFormatOp(plan, JJLFormatFieldYear, '\0', false, 4);
+    }
+    if (c->showMonth) {
+        JJLAddFormatOp(plan, JJLFormatFieldMonth, c->showYear ? dateSeparator : '\0', false, 2);
+    }
+    if (c->showWeekOfYear) {
+        JJLAddFormatOp(plan, JJLFormatFieldWeekOfYear, (c->showYear || c->showMonth) ? dateSeparator : '\0', false, 3);
+    }
+    if (c->showDay) {
+        char separator = (c->showYear || c->showMonth || c->showWeekOfYear) ? dateSeparator : '\0';
+        if (c->showWeekOfYear) {
+            JJLAddFormatOp(plan, JJLFormatFieldDayOfWeek, separator, false, 2);
+        } else if (c->showMonth) {
+            JJLAddFormatOp(plan, JJLFormatFieldDayOfMonth, separator, false, 2);
+        } else {
+            JJLAddFormatOp(plan, JJLFormatFieldDayOfYear, separator, false, 3);
+        }
+    }
+    if (c->showTime) {
+        char timeSeparator = c->showTimeSeparator ? ':' : '\0';
+        JJLAddFormatOp(plan, JJLFormatFieldHour, c->showDate ? (c->timeSeparatorIsSpace ? ' ' : 'T') : '\0', true, 2);
+        JJLAddFormatOp(plan, JJLFormatFieldMinute, timeSeparator, false, 2);
+        JJLAddFormatOp(plan, JJLFormatFieldSecond, timeSeparator, false, 2);
+        if (c->showFractionalSeconds) {
+            JJLAddFormatOp(plan, JJLFormatFieldFractionalSeconds, '\0', false, 1 + c->fractionalSecondDigits);
+        }
+    }
+    if (c->showTimeZone) {
+        // "+HH:mm:ss" at most
+        JJLAddFormatOp(plan, JJLFormatFieldTimeZone, '\0', false, 9);
+    }
+}
 
-    bool showFractionalSeconds = JJLGetShowFractionalSeconds(options);
+JJLFormatPlan *JJLCreateFormatPlan(CFISO8601DateFormatOptions options) {
+    return JJLCreateFormatPlanWithFractionalSecondDigits(options, kJJLDefaultFractionalSecondDigits);
+}
 
-    double unused = 0;
-    double fractionalComponent = modf(timeInSeconds, &unused);
-    // Technically this might not be perfect, maybe 0.9995 is represented with a double just under that, but this seems good enough
-    if (fractionalComponent >= 0.9995) {
-        timeInSeconds = lround(timeInSeconds);
+JJLFormatPlan *JJLCreateFormatPlanWithFractionalSecondDigits(CFISO8601DateFormatOptions options, int32_t fractionalSecondDigits) {
+    if (fractionalSecondDigits < 0 || fractionalSecondDigits > 9) {
+        return NULL;
     }
-    time_t integerTime = (time_t)timeInSeconds;
-    integerTime += fallbackOffset;
-    jjl_localtime_rz(timeZone, &integerTime, &components);
-    components.tm_gmtoff += fallbackOffset;
-    bool showYear = !!(options & kCFISO8601DateFormatWithYear);
-    bool showDateSeparator = !!(options & kCFISO8601DateFormatWithDashSeparatorInDate);
-    bool showMonth = !!(options & kCFISO8601DateFormatWithMonth);
-    bool showDay = !!(options & kCFISO8601DateFormatWithDay);
-    bool isInternetDateTime = (options & kCFISO8601DateFormatWithInternetDateTime) == kCFISO8601DateFormatWithInternetDateTime;
-    // For some reason, the week of the year is never shown if all the components of internet date time are shown
-    bool showWeekOfYear = !isInternetDateTime && !!(options & kCFISO8601DateFormatWithWeekOfYear);
-    bool showDate = showYear || showMonth || showDay || showWeekOfYear;
-    int32_t daysAfterFirstWeekday = (components.tm_wday - 1 + 7) % 7;
+    JJLFormatPlan *plan = malloc(sizeof(JJLFormatPlan));
+    if (plan) {
+        JJLCompileFormatPlan(options, fractionalSecondDigits, plan);
+    }
+    return plan;
+}
+
+void JJLDestroyFormatPlan(JJLFormatPlan *plan) {
+    free(plan);
+}
+
+int32_t JJLMaxLengthForFormatPlan(const JJLFormatPlan *plan) {
+    return plan->maxLength;
+}
+
+static inline void JJLPushTimeZone(char **buffer, int32_t offset, bool showColonSeparator) {
+    if (offset == 0) {
+        *(*buffer)++ = 'Z';
+        return;
+    }
+    char sign = '\0';
+    if (offset < 0) {
+        offset = -offset;
+        sign = '-';
+    } else {
+        sign = '+';
+    }
+    int32_t hours = offset / (60 * 60);
+    int32_t minutes = offset % (60 * 60) / 60;
+    int32_t seconds = offset % 60;
+    *(*buffer)++ = sign;
+    JJLPushNumber(buffer, hours, 2);
+    if (showColonSeparator) {
+        *(*buffer)++ = ':';
+    }
+    JJLPushNumber(buffer, minutes, 2);
+    if (seconds > 0) {
+        if (showColonSeparator) {
+            *(*buffer)++ = ':';
+        }
+        JJLPushNumber(buffer, seconds, 2);
+    }
+}
+
+// The fractional seconds are written from nanoseconds, which must be in [0, 1e9), by truncating them to the precision shown
+static inline int32_t JJLFillBufferForComponentsWithPlanInline(char *buffer, const struct tm *componentsPtr, int32_t nanoseconds, const JJLFormatPlan *plan) {
+    const JJLFormatComponents *c = &plan->components;
+    const struct tm components = *componentsPtr;
+    char *start = buffer;
     int32_t year = components.tm_year + 1900;
-    bool usePreviousYear = showWeekOfYear && daysAfterFirstWeekday - components.tm_yday > 7 - 4;
-    bool useNextYear = showWeekOfYear && components.tm_yday - daysAfterFirstWeekday + 7 - JJLDaysInYear(year) >= 4;
-    if (showYear) {
-        int32_t yearToShow = year;
-        if (usePreviousYear) {
-            yearToShow--;
-        } else if (useNextYear) {
-            yearToShow++;
-        }
-        JJLPushNumber(&buffer, yearToShow, 4);
-    }
-    if (showMonth) {
-        if (showDateSeparator && showYear) {
-            *buffer++ = '-';
-        }
-        JJLPushNumber(&buffer, components.tm_mon + 1, 2);
-    }
-    if (showWeekOfYear) {
-        if (showDateSeparator && (showYear || showMonth)) {
-            *buffer++ = '-';
-        }
-        *buffer++ = 'W';
-        int32_t week = 0;
-        if (useNextYear) {
-            week = 0;
-        } else {
-            int32_t daysToDivide = components.tm_yday - daysAfterFirstWeekday;
-            if (usePreviousYear) {
-                daysToDivide += JJLDaysInYear(year - 1);
+    if (c->isFixedLayout && 0 <= year && year <= 9999 && labs(components.tm_gmtoff) < 100 * 60 * 60) {
+        JJLFixedLayoutFields fields = {
+            .year = year,
+            .month = components.tm_mon + 1,
+            .day = components.tm_mday,
+            .hour = components.tm_hour,
+            .minute = components.tm_min,
+            .second = components.tm_sec,
+            .millis = nanoseconds / 1000000,
+            .timeZoneOffset = (int32_t)components.tm_gmtoff,
+        };
+        return JJLFormatFixedLayout(buffer, c->timeSeparatorIsSpace ? ' ' : 'T', c->showFractionalSeconds, &fields);
+    }
+    int32_t daysAfterFirstWeekday = (components.tm_wday - 1 + 7) % 7;
+    bool usePreviousYear = c->showWeekOfYear && daysAfterFirstWeekday - components.tm_yday > 7 - 4;
+    bool useNextYear = c->showWeekOfYear && components.tm_yday - daysAfterFirstWeekday + 7 - JJLDaysInYear(year) >= 4;
+    for (int32_t i = 0; i < plan->opCount; i++) {
+        const JJLFormatOp *op = &plan->ops[i];
+        if (op->separator) {
+            *buffer++ = op->separator;
+        }
+        switch ((JJLFormatField)op->field) {
+            case JJLFormatFieldYear: {
+                int32_t yearToShow = year;
+                if (usePreviousYear) {
+                    yearToShow--;
+                } else if (useNextYear) {
+                    yearToShow++;
+                }
+                JJLPushNumber(&buffer, yearToShow, 4);
+                break;
             }
-            week = daysToDivide / 7;
-            // See if the first day of this year was considered part of that year or the previous one
-            if (daysToDivide % 7 >= 4) {
-                week++;
+            case JJLFormatFieldMonth:
+                JJLPushNumber(&buffer, components.tm_mon + 1, 2);
+                break;
+            case JJLFormatFieldWeekOfYear: {
+                *buffer++ = 'W';
+                int32_t week = 0;
+                if (useNextYear) {
+                    week = 0;
+                } else {
+                    int32_t daysToDivide = components.tm_yday - daysAfterFirstWeekday;
+                    if (usePreviousYear) {
+                        daysToDivide += JJLDaysInYear(year - 1);
+                    }
+                    week = daysToDivide / 7;
+                    // See if the first day of this year was considered part of that year or the previous one
+                    if (daysToDivide % 7 >= 4) {
+                        week++;
+                    }
+                }
+                JJLPushNumber(&buffer, week + 1, 2);
+                break;
             }
+            case JJLFormatFieldDayOfMonth:
+                JJLPushNumber(&buffer, components.tm_mday, 2);
+                break;
+            case JJLFormatFieldDayOfWeek:
+                JJLPushNumber(&buffer, daysAfterFirstWeekday + 1, 2);
+                break;
+            case JJLFormatFieldDayOfYear:
+                JJLPushNumber(&buffer, components.tm_yday + 1, 3);
+                break;
+            case JJLFormatFieldHour:
+                JJLPushNumber(&buffer, components.tm_hour, 2);
+                break;
+            case JJLFormatFieldMinute:
+                JJLPushNumber(&buffer, components.tm_min, 2);
+                break;
+            case JJLFormatFieldSecond:
+                JJLPushNumber(&buffer, components.tm_sec, 2);
+                break;
+            case JJLFormatFieldFractionalSeconds:
+                *buffer++ = '.';
+                JJLPushFractionalSeconds(&buffer, nanoseconds, c->fractionalSecondDigits);
+                break;
+            case JJLFormatFieldTimeZone:
+                JJLPushTimeZone(&buffer, (int32_t)components.tm_gmtoff, c->showColonSeparatorInTimeZone);
+                break;
         }
-        JJLPushNumber(&buffer, week + 1, 2);
     }
-    if (showDay) {
-        if (showDateSeparator && (showYear || showMonth || showWeekOfYear)) {
-            *buffer++ = '-';
-        }
-        if (showWeekOfYear) {
-            JJLPushNumber(&buffer, daysAfterFirstWeekday + 1, 2);
-        } else if (showMonth) {
-            JJLPushNumber(&buffer, components.tm_mday, 2);
-        } else {
-            JJLPushNumber(&buffer, components.tm_yday + 1, 3);
+    return (int32_t)(buffer - start);
+}
+
+static inline int32_t JJLFillBufferForEpochWithPlanInline(char *buffer, time_t seconds, int32_t nanoseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    if (plan->components.isEmpty) {
+        return 0;
+    }
+    struct tm components = {0};
+    time_t integerTime = 0;
+    // Nothing is written for a time whose local year doesn't fit in an int
+    if (__builtin_add_overflow(seconds, (time_t)fallbackOffset, &integerTime) || !jjl_localtime_rz(timeZone, &integerTime, &components)) {
+        return 0;
+    }
+    components.tm_gmtoff += fallbackOffset;
+    return JJLFillBufferForComponentsWithPlanInline(buffer, &components, nanoseconds, plan);
+}
+
+// Splits the time into the whole seconds and nanoseconds that get shown, with the same rounding as Apple
+static inline time_t JJLSplitTimeInSeconds(double timeInSeconds, const JJLFormatComponents *c, int32_t *nanoseconds) {
+    // With no fraction shown, the seconds are still rounded up within half a millisecond of the next one, like Apple does
+    int32_t digits = c->showFractionalSeconds ? c->fractionalSecondDigits : 3;
+    double unused = 0;
+    double fractionalComponent = modf(timeInSeconds, &unused);
+    // Technically this might not be perfect, maybe 0.9995 is represented with a double just under that, but this seems good enough
+    if (fractionalComponent >= (kJJLPowersOfTen[digits] - 0.5) / kJJLPowersOfTen[digits]) {
+        timeInSeconds = lround(timeInSeconds);
+    }
+    *nanoseconds = c->showFractionalSeconds ? JJLNanosecondsForTime(timeInSeconds, digits) : 0;
+    return (time_t)timeInSeconds;
+}
+
+static inline int32_t JJLFillBufferForDateWithPlanInline(char *buffer, double timeInSeconds, const JJLFormatPlan *plan, timezone_t timeZone, double fallbackOffset) {
+    if (plan->components.isEmpty) {
+        return 0;
+    }
+    int32_t nanoseconds = 0;
+    time_t seconds = JJLSplitTimeInSeconds(timeInSeconds, &plan->components, &nanoseconds);
+    return JJLFillBufferForEpochWithPlanInline(buffer, seconds, nanoseconds, plan, timeZone, (int32_t)fallbackOffset);
+}
+
+// Splits a count of units into whole seconds and nanoseconds in [0, 1e9), rounding the seconds down so that times before 1970 work too
+static inline int32_t JJLFillBufferForEpochUnitsWithPlanInline(char *buffer, int64_t units, int64_t unitsPerSecond, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    int64_t seconds = units / unitsPerSecond;
+    int64_t remainder = units % unitsPerSecond;
+    if (remainder < 0) {
+        remainder += unitsPerSecond;
+        seconds--;
+    }
+    return JJLFillBufferForEpochWithPlanInline(buffer, seconds, (int32_t)(remainder * (1000000000 / unitsPerSecond)), plan, timeZone, fallbackOffset);
+}
+
+// Carries whole seconds out of the nanoseconds, so that they're in [0, 1e9). Returns false if the seconds overflow.
+static inline bool JJLNormalizeNanoseconds(int64_t *seconds, int32_t *nanoseconds) {
+    if (*nanoseconds < 0 || *nanoseconds >= 1000000000) {
+        int64_t carry = *nanoseconds / 1000000000;
+        *nanoseconds %= 1000000000;
+        if (*nanoseconds < 0) {
+            *nanoseconds += 1000000000;
+            carry--;
         }
+        return !__builtin_add_overflow(*seconds, carry, seconds);
     }
+    return true;
+}
+
+int32_t JJLFillBufferForEpochSeconds(char *buffer, int64_t seconds, int32_t nanoseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    if (!JJLNormalizeNanoseconds(&seconds, &nanoseconds)) {
+        return 0;
+    }
+    return JJLFillBufferForEpochWithPlanInline(buffer, seconds, nanoseconds, plan, timeZone, fallbackOffset);
+}
+
+int32_t JJLFillBufferForEpochMillis(char *buffer, int64_t milliseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    return JJLFillBufferForEpochUnitsWithPlanInline(buffer, milliseconds, 1000, plan, timeZone, fallbackOffset);
+}
+
+int32_t JJLFillBufferForEpochMicros(char *buffer, int64_t microseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    return JJLFillBufferForEpochUnitsWithPlanInline(buffer, microseconds, 1000000, plan, timeZone, fallbackOffset);
+}
+
+int32_t JJLFillBufferForEpochNanos(char *buffer, int64_t nanoseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset) {
+    return JJLFillBufferForEpochUnitsWithPlanInline(buffer, nanoseconds, 1000000000, plan, timeZone, fallbackOffset);
+}
+
+int32_t JJLFillBufferForDate(char *buffer, double timeInSeconds, CFISO8601DateFormatOptions options, timezone_t timeZone, double fallbackOffset) {
+    JJLFormatPlan plan;
+    JJLCompileFormatPlan(options, kJJLDefaultFractionalSecondDigits, &plan);
+    return JJLFillBufferForDateWithPlanInline(buffer, timeInSeconds, &plan, timeZone, fallbackOffset);
+}
+
+int32_t JJLFillBufferForDateWithPlan(char *buffer, double timeInSeconds, const JJLFormatPlan *plan, timezone_t timeZone, double fallbackOffset) {
+    return JJLFillBufferForDateWithPlanInline(buffer, timeInSeconds, plan, timeZone, fallbackOffset);
+}
 
-    bool showTime = !!(options & kCFISO8601DateFormatWithTime);
-    bool showTimeSeparator = !!(options & kCFISO8601DateFormatWithColonSeparatorInTime);
-    bool timeSeparatorIsSpace = !!(options & kCFISO8601DateFormatWithSpaceBetweenDateAndTime);
-    if (showTime) {
-        if (showDate) {
-            *buffer++ = timeSeparatorIsSpace ? ' ' : 'T';
+int32_t JJLFillBufferForDates(char *buffer, const double *timesInSeconds, int32_t count, const JJLFormatPlan *plan, timezone_t timeZone, const double *fallbackOffsets, int32_t *offsets) {
+    int32_t position = 0;
+    offsets[0] = 0;
+    if (fallbackOffsets) {
+        for (int32_t i = 0; i < count; i++) {
+            position += JJLFillBufferForDateWithPlanInline(buffer + position, timesInSeconds[i], plan, timeZone, fallbackOffsets[i]);
+            offsets[i + 1] = position;
         }
-        JJLPushNumber(&buffer, components.tm_hour, 2);
-        if (showTimeSeparator) {
-            *buffer++ = ':';
+    } else {
+        for (int32_t i = 0; i < count; i++) {
+            position += JJLFillBufferForDateWithPlanInline(buffer + position, timesInSeconds[i], plan, timeZone, 0);
+            offsets[i + 1] = position;
         }
-        JJLPushNumber(&buffer, components.tm_min, 2);
-        if (showTimeSeparator) {
-            *buffer++ = ':';
+    }
+    return position;
+}
+
+// The last string formatted, and what's needed to tell whether the next one only differs in a few fields
+struct JJLFormatContext {
+    JJLFormatPlan plan;
+    timezone_t timeZone;
+    bool isValid;
+    int64_t second;
+    int32_t length;
+    char text[kJJLMaxDateLength];
+    // The zone's offset is the same throughout [offsetStart, offsetEnd), and the text is for the local day localDay days after 1970-01-01
+    int32_t utcOffset;
+    time_t offsetStart;
+    time_t offsetEnd;
+    int64_t localDay;
+    // Where the digits of each field start in text, or -1 if they're not shown or can't be patched in place
+    int32_t hourPosition;
+    int32_t minutePosition;
+    int32_t secondPosition;
+    int32_t fractionPosition;
+};
+
+JJLFormatContext *JJLCreateFormatContext(const JJLFormatPlan *plan, timezone_t timeZone) {
+    JJLFormatContext *context = malloc(sizeof(JJLFormatContext));
+    if (context) {
+        context->plan = *plan;
+        context->timeZone = timeZone;
+        context->isValid = false;
+    }
+    return context;
+}
+
+void JJLDestroyFormatContext(JJLFormatContext *context) {
+    free(context);
+}
+
+const JJLFormatPlan *JJLFormatPlanForContext(const JJLFormatContext *context) {
+    return &context->plan;
+}
+
+static inline int64_t JJLFloorDivide(int64_t numerator, int64_t denominator) {
+    int64_t quotient = numerator / denominator;
+    return quotient - (numerator % denominator < 0 ? 1 : 0);
+}
+
+// Formats the second from scratch, and works out for how long, and where, the text can be patched for the ones after it
+static void JJLRenderFormatContext(JJLFormatContext *context, int64_t seconds, int32_t nanoseconds) {
+    const JJLFormatPlan *plan = &context->plan;
+    struct tm components = {0};
+    time_t time = seconds;
+    context->hourPosition = context->minutePosition = context->secondPosition = context->fractionPosition = -1;
+    if (!jjl_localtime_rz(context->timeZone, &time, &components)) {
+        // Like JJLFillBufferForEpochSeconds, nothing is written for a time whose local year doesn't fit in an int
+        context->length = 0;
+        context->isValid = false;
+        return;
+    }
+    context->length = JJLFillBufferForComponentsWithPlanInline(context->text, &components, nanoseconds, plan);
+    context->second = seconds;
+    context->isValid = true;
+    context->utcOffset = (int32_t)components.tm_gmtoff;
+    int64_t wallTime = 0;
+    if (__builtin_add_overflow(seconds, (int64_t)context->utcOffset, &wallTime)) {
+        // Only the same second can reuse this
+        context->offsetStart = seconds;
+        context->offsetEnd = seconds;
+    } else {
+        jjl_offset_range_z(context->timeZone, time, &context->offsetStart, &context->offsetEnd);
+    }
+    context->localDay = JJLFloorDivide(wallTime, 24 * 60 * 60);
+    // Every field before the time zone is a fixed width as long as the year (which can also be the one before or after, for the week of
+    // the year) has four digits. Otherwise, nothing is reused
+    int32_t year = components.tm_year + 1900;
+    if (year < 1 || year > 9998) {
+        context->isValid = false;
+        return;
+    }
+    int32_t position = 0;
+    for (int32_t i = 0; i < plan->opCount; i++) {
+        const JJLFormatOp *op = &plan->ops[i];
+        if (op->separator) {
+            position++;
         }
-        JJLPushNumber(&buffer, components.tm_sec, 2);
-        if (showFractionalSeconds) {
-            *buffer++ = '.';
-            JJLFillBufferWithFractionalSeconds(timeInSeconds, &buffer);
+        switch ((JJLFormatField)op->field) {
+            case JJLFormatFieldYear:
+                position += 4;
+                break;
+            case JJLFormatFieldWeekOfYear:
+            case JJLFormatFieldDayOfYear:
+                position += 3;
+                break;
+            case JJLFormatFieldMonth:
+            case JJLFormatFieldDayOfMonth:
+            case JJLFormatFieldDayOfWeek:
+                position += 2;
+                break;
+            case JJLFormatFieldHour:
+                context->hourPosition = position;
+                position += 2;
+                break;
+            case JJLFormatFieldMinute:
+                context->minutePosition = position;
+                position += 2;
+                break;
+            case JJLFormatFieldSecond:
+                context->secondPosition = position;
+                position += 2;
+                break;
+            case JJLFormatFieldFractionalSeconds:
+                context->fractionPosition = position + 1;
+                position += 1 + plan->components.fractionalSecondDigits;
+                break;
+            case JJLFormatFieldTimeZone:
+                break;
         }
     }
-    if (options & kCFISO8601DateFormatWithTimeZone) {
-        int32_t offset = (int32_t)components.tm_gmtoff;
-        if (offset == 0) {
-            *buffer++ = 'Z';
-        } else {
-            char sign = '\0';
-            if (offset < 0) {
-                offset = -offset;
-                sign = '-';
-            } else {
-                sign = '+';
+}
+
+static inline int32_t JJLFillBufferWithContextInline(JJLFormatContext *context, char *buffer, int64_t seconds, int32_t nanoseconds) {
+    const JJLFormatComponents *c = &context->plan.components;
+    if (c->isEmpty) {
+        return 0;
+    }
+    if (!context->isValid || seconds != context->second) {
+        int64_t wallTime = 0;
+        // Within the same offset and local day, only the time of day changes, and the date and time zone can stay as they are. Without
+        // the time shown, the text only changes with the day
+        if (context->isValid && context->offsetStart <= seconds && seconds < context->offsetEnd
+            && !__builtin_add_overflow(seconds, (int64_t)context->utcOffset, &wallTime)
+            && JJLFloorDivide(wallTime, 24 * 60 * 60) == context->localDay && (!c->showTime || context->hourPosition >= 0)) {
+            int32_t secondOfDay = (int32_t)(wallTime - context->localDay * 24 * 60 * 60);
+            if (context->hourPosition >= 0) {
+                char *text = context->text + context->hourPosition;
+                JJLPushNumber(&text, secondOfDay / (60 * 60), 2);
             }
-            bool showColonSeparatorInTimeZone = !!(options & kCFISO8601DateFormatWithColonSeparatorInTimeZone);
-            int32_t hours = offset / (60 * 60);
-            int32_t minutes = offset % (60 * 60) / 60;
-            int32_t seconds = offset % 60;
-            *buffer++ = sign;
-            JJLPushNumber(&buffer, hours, 2);
-            if (showColonSeparatorInTimeZone) {
-                *buffer++ = ':';
+            if (context->minutePosition >= 0) {
+                char *text = context->text + context->minutePosition;
+                JJLPushNumber(&text, secondOfDay / 60 % 60, 2);
             }
-            JJLPushNumber(&buffer, minutes, 2);
-            if (seconds > 0) {
-                if (showColonSeparatorInTimeZone) {
-                    *buffer++ = ':';
-                }
-                JJLPushNumber(&buffer, seconds, 2);
+            if (context->secondPosition >= 0) {
+                char *text = context->text + context->secondPosition;
+                JJLPushNumber(&text, secondOfDay % 60, 2);
             }
+            context->second = seconds;
+        } else {
+            JJLRenderFormatContext(context, seconds, nanoseconds);
         }
     }
+    if (context->fractionPosition >= 0) {
+        char *text = context->text + context->fractionPosition;
+        JJLPushFractionalSeconds(&text, nanoseconds, c->fractionalSecondDigits);
+    }
+    memcpy(buffer, context->text, context->length);
+    return context->length;
+}
+
+int32_t JJLFillBufferForEpochWithContext(JJLFormatContext *context, char *buffer, int64_t seconds, int32_t nanoseconds) {
+    if (!JJLNormalizeNanoseconds(&seconds, &nanoseconds)) {
+        return 0;
+    }
+    return JJLFillBufferWithContextInline(context, buffer, seconds, nanoseconds);
+}
+
+int32_t JJLFillBufferForDateWithContext(JJLFormatContext *context, char *buffer, double timeInSeconds) {
+    int32_t nanoseconds = 0;
+    time_t seconds = JJLSplitTimeInSeconds(timeInSeconds, &context->plan.components, &nanoseconds);
+    return JJLFillBufferWithContextInline(context, buffer, seconds, nanoseconds);
 }
 
 static const int32_t kJJLDigits[][10] = {{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, {0, 10, 20, 30, 40, 50, 60, 70, 80, 90}, {0, 100, 200, 300, 400, 500, 600, 700, 800, 900}, {0, 1000, 2000, 3000, 4000, 5000, 6000, 7000, 8000, 9000}};
@@ -235,7 +662,13 @@ static inline int32_t JJLConsumeNumber(const char **stringPtr, const char *end,
         length++;
     }
     if (unlikely(length > 4)) {
-        return isNegative ? -atoi(string) : atoi(string);
+        // Don't use atoi here, the string isn't necessarily NUL-terminated (e.g. when it's part of a batch)
+        int64_t longNumber = 0;
+        for (int32_t i = 0; i < length && longNumber <= INT32_MAX; i++) {
+            longNumber = longNumber * 10 + (string[i] - '0');
+        }
+        int32_t clamped = longNumber > INT32_MAX ? INT32_MAX : (int32_t)longNumber;
+        return isNegative ? -clamped : clamped;
     }
 
     if (unlikely(length == 0)) {
@@ -284,43 +717,25 @@ static inline bool JJLIsLeapYear(int32_t year) {
     return ((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0);
 }
 
+// The number of days from 1970-01-01 to the given day, where month is 0-11
+static inline int64_t JJLDaysFromCivil(int32_t year, int32_t month, int32_t day) {
+    // Howard Hinnant's days_from_civil, which counts years from March so that the leap day is at the end of one, and needs no
+    // branches on the year or table of month lengths. Valid for any int32_t year
+    int64_t y = (int64_t)year - (month < 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (month < 2 ? month + 10 : month - 2) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    // 719468 is the number of days from 0000-03-01 to 1970-01-01
+    return era * 146097 + dayOfEra - 719468;
+}
+
 // PERF: Fast path - directly compute Unix timestamp without mktime binary search
 // This is used when timezone info is present in the string (UTC or offset)
 // Returns seconds since 1970-01-01 00:00:00 UTC
 static inline int64_t JJLFastMktime(int32_t year, int32_t month, int32_t day, int32_t hour, int32_t min, int32_t sec) {
-    // Days from year 1970 to start of given year
-    static const int32_t kDaysBeforeMonth[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
-    
-    int32_t y = year - 1970;
-    
-    // Calculate days
-    int64_t days = y * 365;
-    
-    // Add leap years: count leap years from 1970 to year-1
-    if (y > 0) {
-        days += (y + 1) / 4;      // Leap years
-        days -= (y + 69) / 100;   // Subtract century years
-        days += (y + 369) / 400;  // Add 400-year cycles
-    } else if (y < 0) {
-        // For years before 1970
-        days += (y - 2) / 4;
-        days -= (y - 30) / 100;
-        days += (y - 30) / 400;
-    }
-    
-    // Add days for months (0-based month)
-    days += kDaysBeforeMonth[month];
-    
-    // Add leap day if after Feb in a leap year
-    if (month > 1 && JJLIsLeapYear(year)) {
-        days++;
-    }
-    
-    // Add days (1-based day)
-    days += day - 1;
-    
     // Convert to seconds and add time
-    return days * 86400LL + hour * 3600LL + min * 60LL + sec;
+    return JJLDaysFromCivil(year, month, day) * 86400LL + hour * 3600LL + min * 60LL + sec;
 }
 
 static inline int32_t JJLStartingDayOfWeekForYear(int32_t y) {
@@ -334,6 +749,7 @@ static inline int32_t JJLStartingDayOfWeekForYear(int32_t y) {
     return (sakamotoResult - 1 + 7) % 7;
 }
 
+// Returns the fraction in nanoseconds. Digits past the ninth are consumed and ignored
 static int32_t JJLConsumeFractionalSeconds(const char **string, const char *end, bool *errorOccurred) {
     if (*string < end) {
         char c = **string;
@@ -345,30 +761,29 @@ static int32_t JJLConsumeFractionalSeconds(const char **string, const char *end,
         }
     }
 
-    const char *origString = *string;
-    // Set end as a way of limiting the number of chars consumed
-    // const char *numberEnd = *string + 3 < end ? *string + 3 : end;
-    int32_t num = JJLConsumeNumber(string, end, 3, errorOccurred);
-    int32_t length = (int32_t)(*string - origString);
-
-    // Consume any leftover part of the decimal and discard it
+    int32_t nanoseconds = 0;
+    int32_t length = 0;
     while (*string < end) {
         char c = **string;
         if (c < '0' || c > '9') {
             break;
         }
+        if (length < 9) {
+            nanoseconds = nanoseconds * 10 + (c - '0');
+        }
+        length++;
         (*string)++;
     }
-
     if (length == 0) {
+        *errorOccurred = true;
         return 0;
-    } else if (length == 1) {
-        return num * 100;
-    } else if (length == 2) {
-        return num * 10;
-    } else { // length == 3
-        return num;
     }
+    return length < 9 ? nanoseconds * kJJLPowersOfTen[9 - length] : nanoseconds;
+}
+
+// The nanoseconds truncated to the given number of digits, as a fraction of a second
+static inline double JJLFractionForNanoseconds(int32_t nanoseconds, int32_t digits) {
+    return (double)(nanoseconds / kJJLPowersOfTen[9 - digits]) / kJJLPowersOfTen[digits];
 }
 
 static inline int32_t JJLConsumeTimeZone(const char **string, const char *end, bool separator, bool *errorOccurred) {
@@ -403,149 +818,313 @@ static inline int32_t JJLConsumeTimeZone(const char **string, const char *end, b
     }
 }
 
-double JJLTimeIntervalForString(const char *string, int32_t length, CFISO8601DateFormatOptions options, timezone_t timeZone, bool *errorOccurred) {
-    if ((options & (options - 1)) == 0) {
+// What a parse context remembers of the last string parsed. The date fields end with the separator before the hour, and the hour with the
+// separator before the minute, so that in a sorted stream of strings, the next one usually starts with the same bytes and they needn't be parsed
+// or converted to days again.
+struct JJLParseContext {
+    JJLFormatPlan plan;
+    timezone_t timeZone;
+    // The index of the op for the hour, and for the minute if there's a separator before it, or -1 if not
+    int32_t hourOpIndex;
+    int32_t minuteOpIndex;
+    // How much of prefix, which is the start of the last string, holds the date (and separator) and the hour (and separator), or -1 if
+    // nothing's cached
+    int32_t dayPrefixLength;
+    int32_t hourPrefixLength;
+    char prefix[kJJLMaxDateLength];
+    // Only tm_year, tm_mon and tm_mday are used
+    struct tm dateComponents;
+    // The days since 1970 for dateComponents
+    int64_t days;
+    int32_t hour;
+};
+
+// Returns the whole seconds since 1970, and sets *nanoseconds to the fraction, truncated to the plan's precision. With a context, its plan and
+// zone are used, and the date (and hour) are reused from the last string when it starts the same way.
+static inline int64_t JJLEpochSecondsForStringWithPlanInline(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, JJLParseContext *context, int32_t *nanosecondsOut, bool *errorOccurred) {
+    const JJLFormatComponents *c = &plan->components;
+    *nanosecondsOut = 0;
+    if (c->isEmpty) {
         *errorOccurred = true;
         return 0;
     }
 
+    if (c->isFixedLayout) {
+        // PERF: Vectorized fast path for the default options. If the string isn't exactly in the expected layout,
+        // the general parser below deals with it
+        JJLFixedLayoutFields fields;
+        if (JJLParseFixedLayout(string, length, c->timeSeparatorIsSpace ? ' ' : 'T', c->showFractionalSeconds, &fields)) {
+            int64_t days = 0;
+            if (context && context->dayPrefixLength >= 0 && fields.year == context->dateComponents.tm_year + 1900
+                && fields.month - 1 == context->dateComponents.tm_mon && fields.day == context->dateComponents.tm_mday) {
+                days = context->days;
+            } else {
+                days = JJLDaysFromCivil(fields.year, fields.month - 1, fields.day);
+                if (context) {
+                    // "yyyy-MM-ddT" is the date and the separator before the hour, which parse the same either way
+                    context->dateComponents = (struct tm){ .tm_year = fields.year - 1900, .tm_mon = fields.month - 1, .tm_mday = fields.day };
+                    context->days = days;
+                    context->dayPrefixLength = 11;
+                    context->hourPrefixLength = -1;
+                    memcpy(context->prefix, string, 11);
+                }
+            }
+            int64_t timestamp = days * 86400LL + fields.hour * 3600LL + fields.minute * 60LL + fields.second;
+            timestamp -= fields.timeZoneOffset;
+            *nanosecondsOut = fields.millis * 1000000;
+            return timestamp;
+        }
+    }
+
     const char *origStringPosition = string;
     const char *end = origStringPosition + length;
     struct tm components = {0};
 
-    bool showFractionalSeconds = JJLGetShowFractionalSeconds(options);
-
-    bool showYear = !!(options & kCFISO8601DateFormatWithYear);
-    bool showDateSeparator = !!(options & kCFISO8601DateFormatWithDashSeparatorInDate);
-    bool showMonth = !!(options & kCFISO8601DateFormatWithMonth);
-    bool showDay = !!(options & kCFISO8601DateFormatWithDay);
-    bool showTime = !!(options & kCFISO8601DateFormatWithTime);
-    bool showTimeSeparator = !!(options & kCFISO8601DateFormatWithColonSeparatorInTime);
-    bool timeSeparatorIsSpace = !!(options & kCFISO8601DateFormatWithSpaceBetweenDateAndTime);
-    bool showTimeZone = !!(options & kCFISO8601DateFormatWithTimeZone);
-    bool isInternetDateTime = (options & kCFISO8601DateFormatWithInternetDateTime) == kCFISO8601DateFormatWithInternetDateTime;
-    bool showColonSeparatorInTimeZone = options & kCFISO8601DateFormatWithColonSeparatorInTimeZone;
-    // For some reason, the week of the year is never shown if all the components of internet date time are shown
-    bool showWeekOfYear = !isInternetDateTime && !!(options & kCFISO8601DateFormatWithWeekOfYear);
-    bool showDate = showYear || showMonth || showDay || showWeekOfYear;
     int32_t dayOffset = 1;
-    int32_t year = showYear ? JJLConsumeNumber(&string, end, 4, errorOccurred) : 2000;
-    int32_t firstMonday = (7 - JJLStartingDayOfWeekForYear(year)) % 7;
-    if (showWeekOfYear) {
-        dayOffset += firstMonday < 4 ? firstMonday : firstMonday - 7;
-    }
-    components.tm_year = year - 1900;
-
-    if (showMonth) {
-        if (showDateSeparator && showYear) {
-            JJLConsumeSeparator(&string, end, errorOccurred);
-        }
-        int32_t month = JJLConsumeNumber(&string, end, 2, errorOccurred) - 1;
-        if (!showWeekOfYear) {
-            components.tm_mon = month;
+    int32_t year = 2000;
+    int32_t nanoseconds = 0;
+    int32_t tzOffset = 0;
+    int32_t firstOp = 0;
+    bool isDateCached = false;
+    if (context && context->dayPrefixLength >= 0) {
+        // The op to resume from has its separator in the prefix, so it's skipped
+        if (context->hourPrefixLength >= 0 && length >= context->hourPrefixLength && memcmp(string, context->prefix, context->hourPrefixLength) == 0) {
+            string += context->hourPrefixLength;
+            firstOp = context->minuteOpIndex;
+            components.tm_hour = context->hour;
+            isDateCached = true;
+        } else if (length >= context->dayPrefixLength && memcmp(string, context->prefix, context->dayPrefixLength) == 0) {
+            string += context->dayPrefixLength;
+            firstOp = context->hourOpIndex;
+            isDateCached = true;
         }
     }
-
-    if (showWeekOfYear) {
-        if (showDateSeparator && (showYear || showMonth)) {
-            JJLConsumeSeparator(&string, end, errorOccurred);
-        }
-        JJLConsumeCharacter(&string, end, 'W', errorOccurred);
-        int32_t weeks = -1 + JJLConsumeNumber(&string, end, 2, errorOccurred);
-        dayOffset += weeks * 7;
-    }
-
-    if (showDay) {
-        if (showDateSeparator && (showYear || showMonth || showWeekOfYear)) {
-            JJLConsumeSeparator(&string, end, errorOccurred);
+    // Where the hour and minute start (after their separators), for the context to remember
+    const char *hourStart = NULL;
+    const char *minuteStart = NULL;
+    for (int32_t i = firstOp; i < plan->opCount; i++) {
+        const JJLFormatOp *op = &plan->ops[i];
+        if (op->separator && !(isDateCached && i == firstOp)) {
+            if (op->separatorIsExact) {
+                JJLConsumeCharacter(&string, end, op->separator, errorOccurred);
+            } else {
+                JJLConsumeSeparator(&string, end, errorOccurred);
+            }
         }
-        dayOffset += JJLConsumeNumber(&string, end, -1, errorOccurred);
-        // if (!showWeekOfYear) {
-            // Day of year and month of year are 1-based
-            dayOffset--;
-        // }
-    }
-
-    if (showMonth) {
-        components.tm_mday = dayOffset;
-    } else {
-        int32_t febDays = JJLIsLeapYear(year) ? 29 : 28;
-        int32_t daysInMonth[] = {31, febDays, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31, 365 /*week of year*/};
-        int32_t month = 0;
-        for (; month < 12; month++) {
-            int32_t monthDays = daysInMonth[month];
-            if (dayOffset <= monthDays) {
+        switch ((JJLFormatField)op->field) {
+            case JJLFormatFieldYear:
+                year = JJLConsumeNumber(&string, end, 4, errorOccurred);
+                break;
+            case JJLFormatFieldMonth: {
+                int32_t month = JJLConsumeNumber(&string, end, 2, errorOccurred) - 1;
+                if (!c->showWeekOfYear) {
+                    components.tm_mon = month;
+                }
+                break;
+            }
+            case JJLFormatFieldWeekOfYear: {
+                JJLConsumeCharacter(&string, end, 'W', errorOccurred);
+                int32_t weeks = -1 + JJLConsumeNumber(&string, end, 2, errorOccurred);
+                dayOffset += weeks * 7;
                 break;
             }
-            dayOffset -= monthDays;
+            case JJLFormatFieldDayOfMonth:
+            case JJLFormatFieldDayOfWeek:
+            case JJLFormatFieldDayOfYear:
+                // Day of year and month of year are 1-based
+                dayOffset += JJLConsumeNumber(&string, end, -1, errorOccurred) - 1;
+                break;
+            case JJLFormatFieldHour:
+                hourStart = string;
+                components.tm_hour = JJLConsumeNumber(&string, end, 2, errorOccurred);
+                break;
+            case JJLFormatFieldMinute:
+                minuteStart = string;
+                components.tm_min = JJLConsumeNumber(&string, end, 2, errorOccurred);
+                break;
+            case JJLFormatFieldSecond:
+                components.tm_sec = JJLConsumeNumber(&string, end, 2, errorOccurred);
+                break;
+            case JJLFormatFieldFractionalSeconds:
+                nanoseconds = JJLConsumeFractionalSeconds(&string, end, errorOccurred);
+                break;
+            case JJLFormatFieldTimeZone:
+                // JJLConsumeTimeZone returns offset in SECONDS
+                tzOffset = JJLConsumeTimeZone(&string, end, c->showColonSeparatorInTimeZone, errorOccurred);
+                break;
         }
-        if (month == 12) {
-            components.tm_mon = 0;
-            components.tm_year++;
-        } else {
-            components.tm_mon = month;
+        if (unlikely(*errorOccurred)) {
+            return 0;
         }
-        components.tm_mday = dayOffset;
     }
+    int32_t truncation = kJJLPowersOfTen[9 - c->fractionalSecondDigits];
+    *nanosecondsOut = nanoseconds / truncation * truncation;
 
-    int32_t millis = 0;
-    if (showTime) {
-        if (showDate) {
-            char separator = timeSeparatorIsSpace ? ' ' : 'T';
-            JJLConsumeCharacter(&string, end, separator, errorOccurred);
+    int64_t days = 0;
+    if (isDateCached) {
+        components.tm_year = context->dateComponents.tm_year;
+        components.tm_mon = context->dateComponents.tm_mon;
+        components.tm_mday = context->dateComponents.tm_mday;
+        days = context->days;
+    } else {
+        if (c->showWeekOfYear) {
+            int32_t firstMonday = (7 - JJLStartingDayOfWeekForYear(year)) % 7;
+            dayOffset += firstMonday < 4 ? firstMonday : firstMonday - 7;
         }
-        components.tm_hour = JJLConsumeNumber(&string, end, 2, errorOccurred);
-        // components.tm_hour--;
-        if (showTimeSeparator) {
-            JJLConsumeSeparator(&string, end, errorOccurred);
+        components.tm_year = year - 1900;
+
+        if (c->showMonth) {
+            components.tm_mday = dayOffset;
+        } else {
+            int32_t febDays = JJLIsLeapYear(year) ? 29 : 28;
+            int32_t daysInMonth[] = {31, febDays, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31, 365 /*week of year*/};
+            int32_t month = 0;
+            for (; month < 12; month++) {
+                int32_t monthDays = daysInMonth[month];
+                if (dayOffset <= monthDays) {
+                    break;
+                }
+                dayOffset -= monthDays;
+            }
+            if (month == 12) {
+                components.tm_mon = 0;
+                components.tm_year++;
+            } else {
+                components.tm_mon = month;
+            }
+            components.tm_mday = dayOffset;
         }
-        components.tm_min = JJLConsumeNumber(&string, end, 2, errorOccurred);
-        if (showTimeSeparator) {
-            JJLConsumeSeparator(&string, end, errorOccurred);
+        days = JJLDaysFromCivil(components.tm_year + 1900, components.tm_mon, components.tm_mday);
+    }
+    if (context) {
+        // Only a string that parsed is remembered. If the hour came from the cache, so did the date
+        if (hourStart) {
+            context->dayPrefixLength = (int32_t)(hourStart - origStringPosition);
+            context->dateComponents = components;
+            context->days = days;
         }
-        components.tm_sec = JJLConsumeNumber(&string, end, 2, errorOccurred);
-        if (showFractionalSeconds) {
-            millis = JJLConsumeFractionalSeconds(&string, end, errorOccurred);
+        context->hourPrefixLength = minuteStart && context->minuteOpIndex >= 0 ? (int32_t)(minuteStart - origStringPosition) : -1;
+        context->hour = components.tm_hour;
+        int32_t prefixLength = context->hourPrefixLength >= 0 ? context->hourPrefixLength : context->dayPrefixLength;
+        if (prefixLength > (int32_t)sizeof(context->prefix)) {
+            context->dayPrefixLength = -1;
+            context->hourPrefixLength = -1;
+        } else if (prefixLength > 0) {
+            memcpy(context->prefix, origStringPosition, prefixLength);
         }
     }
-    if (showTimeZone) {
+    // The same as JJLFastMktime
+    int64_t wallTime = days * 86400LL + components.tm_hour * 3600LL + components.tm_min * 60LL + components.tm_sec;
+
+    if (c->showTimeZone) {
         // PERF: Fast path - use direct calculation instead of mktime binary search
-        // When timezone is in the string, we know the exact UTC offset
-        // JJLConsumeTimeZone returns offset in SECONDS
-        int32_t tzOffset = JJLConsumeTimeZone(&string, end, showColonSeparatorInTimeZone, errorOccurred);
-        
-        if (*errorOccurred) {
-            return 0;
-        }
-        
-        // Direct calculation: much faster than jjl_mktime_z's binary search
-        // timestamp is in SECONDS from 1970 UTC
-        int64_t timestamp = JJLFastMktime(
-            components.tm_year + 1900,
-            components.tm_mon,
-            components.tm_mday,
-            components.tm_hour,
-            components.tm_min,
-            components.tm_sec
-        );
-        
-        // Subtract timezone offset to get UTC
-        // Both timestamp and tzOffset are in SECONDS
-        timestamp -= tzOffset;
-        
-        return (double)timestamp + millis / 1000.0;
+        // When timezone is in the string, we know the exact UTC offset, and the time is just the wall time less it
+        return wallTime - tzOffset;
     } else {
         // This path handles ISO 8601 "Local Time" (strings without explicit timezone).
         // Because the UTC offset for a local time can vary (due to DST or historical changes),
-        // we must use jjl_mktime_z to perform a binary search on the timezone transition table
-        // to resolve the correct UTC timestamp.
+        // it has to be resolved against the time zone's transitions.
+        // PERF: The zone keeps its transitions in wall clock time, so this is a single lookup
+        if (0 <= components.tm_mon && components.tm_mon < 12) {
+            time_t time = 0;
+            if (jjl_wall_to_utc_z(timeZone, wallTime, &time)) {
+                return time;
+            }
+        }
+        // Otherwise, fall back to jjl_mktime_z's binary search
         components.tm_isdst = -1; // Let library decide
         
-        if (*errorOccurred) {
-            return 0;
+        return jjl_mktime_z(timeZone, &components);
+    }
+}
+
+JJLParseContext *JJLCreateParseContext(const JJLFormatPlan *plan, timezone_t timeZone) {
+    JJLParseContext *context = malloc(sizeof(JJLParseContext));
+    if (context) {
+        context->plan = *plan;
+        context->timeZone = timeZone;
+        context->hourOpIndex = -1;
+        context->minuteOpIndex = -1;
+        for (int32_t i = 0; i < plan->opCount; i++) {
+            if (plan->ops[i].field == JJLFormatFieldHour) {
+                context->hourOpIndex = i;
+            } else if (plan->ops[i].field == JJLFormatFieldMinute && plan->ops[i].separator) {
+                context->minuteOpIndex = i;
+            }
         }
-        
-        time_t time = jjl_mktime_z(timeZone, &components);
-        return time + millis / 1000.0;
+        context->dayPrefixLength = -1;
+        context->hourPrefixLength = -1;
+    }
+    return context;
+}
+
+void JJLDestroyParseContext(JJLParseContext *context) {
+    free(context);
+}
+
+int64_t JJLEpochSecondsForStringWithContext(JJLParseContext *context, const char *string, int32_t length, int32_t *nanoseconds, bool *errorOccurred) {
+    return JJLEpochSecondsForStringWithPlanInline(string, length, &context->plan, context->timeZone, context, nanoseconds, errorOccurred);
+}
+
+double JJLTimeIntervalForStringWithContext(JJLParseContext *context, const char *string, int32_t length, bool *errorOccurred) {
+    int32_t nanoseconds = 0;
+    int64_t seconds = JJLEpochSecondsForStringWithPlanInline(string, length, &context->plan, context->timeZone, context, &nanoseconds, errorOccurred);
+    return (double)seconds + JJLFractionForNanoseconds(nanoseconds, context->plan.components.fractionalSecondDigits);
+}
+
+static inline double JJLTimeIntervalForStringWithPlanInline(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, bool *errorOccurred) {
+    int32_t nanoseconds = 0;
+    int64_t seconds = JJLEpochSecondsForStringWithPlanInline(string, length, plan, timeZone, NULL, &nanoseconds, errorOccurred);
+    return (double)seconds + JJLFractionForNanoseconds(nanoseconds, plan->components.fractionalSecondDigits);
+}
+
+double JJLTimeIntervalForString(const char *string, int32_t length, CFISO8601DateFormatOptions options, timezone_t timeZone, bool *errorOccurred) {
+    JJLFormatPlan plan;
+    JJLCompileFormatPlan(options, kJJLDefaultFractionalSecondDigits, &plan);
+    return JJLTimeIntervalForStringWithPlanInline(string, length, &plan, timeZone, errorOccurred);
+}
+
+double JJLTimeIntervalForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, bool *errorOccurred) {
+    return JJLTimeIntervalForStringWithPlanInline(string, length, plan, timeZone, errorOccurred);
+}
+
+int64_t JJLEpochSecondsForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, int32_t *nanoseconds, bool *errorOccurred) {
+    return JJLEpochSecondsForStringWithPlanInline(string, length, plan, timeZone, NULL, nanoseconds, errorOccurred);
+}
+
+int64_t JJLEpochNanosForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, bool *errorOccurred, bool *overflowOccurred) {
+    int32_t nanoseconds = 0;
+    int64_t seconds = JJLEpochSecondsForStringWithPlanInline(string, length, plan, timeZone, NULL, &nanoseconds, errorOccurred);
+    if (seconds < 0 && nanoseconds > 0) {
+        // Count back from the next second, so that the earliest time that fits doesn't overflow before the nanoseconds are added
+        seconds++;
+        nanoseconds -= 1000000000;
+    }
+    int64_t result = 0;
+    if (__builtin_mul_overflow(seconds, (int64_t)1000000000, &result) || __builtin_add_overflow(result, (int64_t)nanoseconds, &result)) {
+        *overflowOccurred = true;
+        return 0;
+    }
+    return result;
+}
+
+int32_t JJLTimeIntervalsForStrings(const char *buffer, const int32_t *offsets, int32_t count, const JJLFormatPlan *plan, timezone_t timeZone, double *results, uint8_t *validity) {
+    int32_t validCount = 0;
+    uint8_t validityByte = 0;
+    for (int32_t i = 0; i < count; i++) {
+        bool errorOccurred = false;
+        double result = JJLTimeIntervalForStringWithPlanInline(buffer + offsets[i], offsets[i + 1] - offsets[i], plan, timeZone, &errorOccurred);
+        // Branchless so that a bad row doesn't cost a mispredict
+        results[i] = errorOccurred ? 0 : result;
+        validityByte |= (uint8_t)(!errorOccurred) << (i & 7);
+        validCount += !errorOccurred;
+        if ((i & 7) == 7) {
+            validity[i >> 3] = validityByte;
+            validityByte = 0;
+        }
+    }
+    if (count & 7) {
+        validity[count >> 3] = validityByte;
     }
+    return validCount;
 }
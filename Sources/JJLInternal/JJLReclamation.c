@@ -0,0 +1,154 @@
+//Copyright (c) 2018 Michael Eisel. All rights reserved.
+
+#import <pthread.h>
+#import <stdlib.h>
+
+#import "JJLInternal.h"
+
+// Epoch-based reclamation. There's a global epoch, which each retirement advances, and each thread has a record of the epoch it was in when
+// it entered its outermost read section, or 0 when it's in none. An object that's retired in epoch E was replaced before the epoch moved
+// past E, so a reader that entered later can only have loaded its replacement, and the object can be released once no thread is still in
+// a read section that it entered in E or earlier.
+//
+// Readers only write their own record, which is on its own cache line, so read sections don't contend with each other. Records are never
+// freed, but a thread's is given to the next new thread once it exits.
+
+typedef struct JJLReader {
+    // The epoch when the thread entered its outermost read section, or 0
+    uint64_t epoch;
+    // Only used by the thread that owns the record
+    int32_t depth;
+    // Whether a thread owns the record
+    int32_t inUse;
+    struct JJLReader *next;
+} JJLReader;
+
+typedef struct JJLRetiredObject {
+    void *object;
+    void (*release)(void *object);
+    uint64_t epoch;
+    struct JJLRetiredObject *next;
+} JJLRetiredObject;
+
+// A reader's record is at least this far from any other's, so that they aren't on the same cache line
+#define JJL_READER_ALIGNMENT 128
+
+static uint64_t sEpoch = 1;
+// Only ever prepended to, with a compare-and-swap
+static JJLReader *sReaders;
+static __thread JJLReader *tReader;
+static pthread_key_t sReaderKey;
+static pthread_once_t sReaderKeyOnce = PTHREAD_ONCE_INIT;
+// Only used with sRetiredLock held
+static JJLRetiredObject *sRetired;
+static pthread_mutex_t sRetiredLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called when a thread that has a record exits
+static void JJLReleaseReader(void *value) {
+    JJLReader *reader = value;
+    reader->depth = 0;
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&reader->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static void JJLCreateReaderKey(void) {
+    pthread_key_create(&sReaderKey, JJLReleaseReader);
+}
+
+static JJLReader *JJLAcquireReader(void) {
+    pthread_once(&sReaderKeyOnce, JJLCreateReaderKey);
+    JJLReader *reader = NULL;
+    for (JJLReader *r = __atomic_load_n(&sReaders, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int32_t unused = 0;
+        if (__atomic_compare_exchange_n(&r->inUse, &unused, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            reader = r;
+            break;
+        }
+    }
+    if (!reader) {
+        void *memory = NULL;
+        if (posix_memalign(&memory, JJL_READER_ALIGNMENT, JJL_READER_ALIGNMENT) != 0) {
+            abort();
+        }
+        reader = memory;
+        reader->epoch = 0;
+        reader->depth = 0;
+        reader->inUse = 1;
+        reader->next = __atomic_load_n(&sReaders, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&sReaders, &reader->next, reader, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_setspecific(sReaderKey, reader);
+    tReader = reader;
+    return reader;
+}
+
+void JJLEnterReadSection(void) {
+    JJLReader *reader = tReader;
+    if (__builtin_expect(!reader, 0)) {
+        reader = JJLAcquireReader();
+    }
+    if (reader->depth++ == 0) {
+        __atomic_store_n(&reader->epoch, __atomic_load_n(&sEpoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        // Pairs with the fence in JJLReclaimRetired: either that sees this epoch, or what's read after this sees the replacements of
+        // everything retired before it
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+void JJLExitReadSection(void) {
+    JJLReader *reader = tReader;
+    if (--reader->depth == 0) {
+        __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void JJLRetire(void *object, void (*release)(void *object)) {
+    JJLRetiredObject *retired = malloc(sizeof(JJLRetiredObject));
+    if (!retired) {
+        abort();
+    }
+    retired->object = object;
+    retired->release = release;
+    pthread_mutex_lock(&sRetiredLock);
+    retired->epoch = __atomic_fetch_add(&sEpoch, 1, __ATOMIC_SEQ_CST);
+    retired->next = sRetired;
+    sRetired = retired;
+    pthread_mutex_unlock(&sRetiredLock);
+    JJLReclaimRetired();
+}
+
+void JJLReclaimRetired(void) {
+    pthread_mutex_lock(&sRetiredLock);
+    if (!sRetired) {
+        pthread_mutex_unlock(&sRetiredLock);
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t oldestEpoch = UINT64_MAX;
+    for (JJLReader *reader = __atomic_load_n(&sReaders, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        uint64_t epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < oldestEpoch) {
+            oldestEpoch = epoch;
+        }
+    }
+    JJLRetiredObject *reclaimable = NULL;
+    for (JJLRetiredObject **link = &sRetired; *link;) {
+        JJLRetiredObject *retired = *link;
+        if (retired->epoch < oldestEpoch) {
+            *link = retired->next;
+            retired->next = reclaimable;
+            reclaimable = retired;
+        } else {
+            link = &retired->next;
+        }
+    }
+    pthread_mutex_unlock(&sRetiredLock);
+    // Released without the lock, since releasing may retire more
+    while (reclaimable) {
+        JJLRetiredObject *next = reclaimable->next;
+        reclaimable->release(reclaimable->object);
+        free(reclaimable);
+        reclaimable = next;
+    }
+}
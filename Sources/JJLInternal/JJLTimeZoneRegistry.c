@@ -0,0 +1,321 @@
+//Copyright (c) 2018 Michael Eisel. All rights reserved.
+
+#import <pthread.h>
+#import <stdlib.h>
+#import <string.h>
+
+#import "JJLInternal.h"
+
+// An open-addressed hash table of names and their zones. Readers probe it and pin what they find with atomic operations and no lock.
+// Writers, which only come along when a name isn't in the table, take a lock to add it, and to evict the least recently used entries that
+// aren't pinned when the table's over capacity.
+//
+// Each entry's state holds its pin count and a generation, which eviction bumps. A reader pins an entry by compare-and-swapping the state
+// it loaded to one more pin, and only reads the entry's name once it's pinned, so it can't see one that's being evicted or reused: once the
+// evictor has swapped an unpinned state to evicted, no pin can succeed, and an entry that's been evicted and reused has a different
+// generation, so that a reader still holding the old state fails to pin it.
+
+typedef struct {
+    // The generation in the high 32 bits, and in the low 32 kJJLEntryEmpty, kJJLEntryEvicted, or kJJLEntryLive plus the pin count
+    uint64_t state;
+    // Atomic, since readers check it before they've pinned the entry
+    uint64_t hash;
+    // When the entry was last acquired or released, in misses since launch, which readers only need to load
+    uint64_t lastUsed;
+    // Kept with the entry rather than in one counter, which every thread would contend for
+    uint64_t hits;
+    // The rest only change with the lock held and the entry not live
+    int32_t length;
+    char *name;
+    timezone_t timeZone;
+} JJLRegistryEntry;
+
+// Never used, so probes for a name can stop here
+static const uint32_t kJJLEntryEmpty = 0;
+// Used and then evicted, so probes have to go on past it
+static const uint32_t kJJLEntryEvicted = 1;
+static const uint32_t kJJLEntryLive = 2;
+
+// A power of two, with room to spare, since a table that's nearly full makes for long probes
+#define JJL_REGISTRY_CAPACITY 4096
+#define JJL_REGISTRY_MAX_COUNT (JJL_REGISTRY_CAPACITY / 4 * 3)
+#define JJL_REGISTRY_DEFAULT_CAPACITY 1024
+
+static JJLRegistryEntry sEntries[JJL_REGISTRY_CAPACITY];
+// How far past its hash any entry has been put, so that lookups know where to stop when there's no empty entry along the way
+static int32_t sMaxProbeLength;
+// The rest are only written with sRegistryLock held
+static int32_t sCount;
+static int32_t sCapacity = JJL_REGISTRY_DEFAULT_CAPACITY;
+static uint64_t sMisses;
+// Hits of entries that have since been evicted
+static uint64_t sEvictedHits;
+static uint64_t sEvictions;
+static pthread_mutex_t sRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a, which is plenty for names this short
+static inline uint64_t JJLHashName(const char *name, int32_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int32_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline uint32_t JJLEntryStatus(uint64_t state) {
+    return (uint32_t)state;
+}
+
+static inline int32_t JJLTwoDigitNumber(const char *string) {
+    if (string[0] < '0' || string[0] > '9' || string[1] < '0' || string[1] > '9') {
+        return -1;
+    }
+    return (string[0] - '0') * 10 + (string[1] - '0');
+}
+
+bool JJLFixedOffsetForTimeZoneName(const char *name, int32_t length, int32_t *offset) {
+    if (length < 3 || memcmp(name, "GMT", 3) != 0) {
+        return false;
+    }
+    if (length == 3) {
+        *offset = 0;
+        return true;
+    }
+    int32_t sign = name[3] == '+' ? 1 : name[3] == '-' ? -1 : 0;
+    const char *digits = name + 4;
+    int32_t digitsLength = length - 4;
+    int32_t hours = -1;
+    int32_t minutes = -1;
+    if (sign == 0) {
+        return false;
+    } else if (digitsLength == 2) {
+        hours = JJLTwoDigitNumber(digits);
+        minutes = 0;
+    } else if (digitsLength == 4) {
+        hours = JJLTwoDigitNumber(digits);
+        minutes = JJLTwoDigitNumber(digits + 2);
+    } else if (digitsLength == 5 && digits[2] == ':') {
+        hours = JJLTwoDigitNumber(digits);
+        minutes = JJLTwoDigitNumber(digits + 3);
+    }
+    if (hours < 0 || hours >= 24 || minutes < 0 || minutes >= 60) {
+        return false;
+    }
+    *offset = sign * (hours * 60 + minutes) * 60;
+    return true;
+}
+
+// Writes the name that all names for the offset are kept under, e.g. "GMT+0800" for "GMT+08:00", and returns its length
+static int32_t JJLCanonicalFixedOffsetName(char *buffer, int32_t offset) {
+    if (offset == 0) {
+        memcpy(buffer, "GMT", 3);
+        return 3;
+    }
+    int32_t minutes = offset / 60;
+    buffer[0] = 'G';
+    buffer[1] = 'M';
+    buffer[2] = 'T';
+    buffer[3] = minutes < 0 ? '-' : '+';
+    minutes = minutes < 0 ? -minutes : minutes;
+    buffer[4] = '0' + minutes / 600;
+    buffer[5] = '0' + minutes / 60 % 10;
+    buffer[6] = '0' + minutes % 60 / 10;
+    buffer[7] = '0' + minutes % 10;
+    return 8;
+}
+
+// Pins the entry for the name and returns its index, or returns -1 if it isn't in the table
+static JJLTimeZoneHandle JJLPinTimeZoneHandle(const char *name, int32_t length, uint64_t hash) {
+    int32_t maxProbeLength = __atomic_load_n(&sMaxProbeLength, __ATOMIC_ACQUIRE);
+    for (int32_t i = 0; i < maxProbeLength; i++) {
+        JJLTimeZoneHandle handle = (hash + i) & (JJL_REGISTRY_CAPACITY - 1);
+        JJLRegistryEntry *entry = &sEntries[handle];
+        uint64_t state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+        while (true) {
+            if (JJLEntryStatus(state) == kJJLEntryEmpty) {
+                return -1;
+            }
+            if (JJLEntryStatus(state) == kJJLEntryEvicted || __atomic_load_n(&entry->hash, __ATOMIC_RELAXED) != hash) {
+                break;
+            }
+            // On failure, state is reloaded, and if the entry was evicted meanwhile, the checks above skip it
+            if (__atomic_compare_exchange_n(&entry->state, &state, state + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                if (entry->length == length && memcmp(entry->name, name, length) == 0) {
+                    return handle;
+                }
+                // Only the hash matched
+                __atomic_fetch_sub(&entry->state, 1, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+    }
+    return -1;
+}
+
+static timezone_t JJLLoadTimeZone(const char *name, int32_t length, JJLTimeZoneLoader load, void *info) {
+    int32_t offset = 0;
+    if (JJLFixedOffsetForTimeZoneName(name, length, &offset)) {
+        // A fixed offset needs nothing loaded, and the zone converts times without any lookup
+        return jjl_tzalloc_fixed(offset);
+    }
+    char *terminated = malloc(length + 1);
+    if (!terminated) {
+        return NULL;
+    }
+    memcpy(terminated, name, length);
+    terminated[length] = '\0';
+    timezone_t timeZone = jjl_tzalloc(terminated);
+    free(terminated);
+    if (!timeZone && load) {
+        timeZone = load(name, length, info);
+    }
+    return timeZone;
+}
+
+// Evicts the least recently used entry that isn't pinned, and returns false if every entry is pinned. Only called with sRegistryLock held
+static bool JJLEvictLeastRecentlyUsed(void) {
+    while (true) {
+        JJLRegistryEntry *leastRecentlyUsed = NULL;
+        uint64_t leastRecentlyUsedState = 0;
+        for (int32_t i = 0; i < JJL_REGISTRY_CAPACITY; i++) {
+            JJLRegistryEntry *entry = &sEntries[i];
+            uint64_t state = __atomic_load_n(&entry->state, __ATOMIC_RELAXED);
+            if (JJLEntryStatus(state) != kJJLEntryLive) {
+                continue;
+            }
+            if (!leastRecentlyUsed || __atomic_load_n(&entry->lastUsed, __ATOMIC_RELAXED) < __atomic_load_n(&leastRecentlyUsed->lastUsed, __ATOMIC_RELAXED)) {
+                leastRecentlyUsed = entry;
+                leastRecentlyUsedState = state;
+            }
+        }
+        if (!leastRecentlyUsed) {
+            return false;
+        }
+        // Fails if a reader pinned it in the meantime, in which case it's no longer the least recently used
+        uint64_t evictedState = ((leastRecentlyUsedState >> 32) + 1) << 32 | kJJLEntryEvicted;
+        if (__atomic_compare_exchange_n(&leastRecentlyUsed->state, &leastRecentlyUsedState, evictedState, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            if (leastRecentlyUsed->timeZone) {
+                jjl_tzfree(leastRecentlyUsed->timeZone);
+                leastRecentlyUsed->timeZone = NULL;
+            }
+            free(leastRecentlyUsed->name);
+            leastRecentlyUsed->name = NULL;
+            sEvictedHits += __atomic_load_n(&leastRecentlyUsed->hits, __ATOMIC_RELAXED);
+            __atomic_store_n(&leastRecentlyUsed->hits, 0, __ATOMIC_RELAXED);
+            sCount--;
+            __atomic_store_n(&sEvictions, sEvictions + 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+}
+
+// Adds the name, pinned, and returns its index, or -1 if there's no room. Only called with sRegistryLock held
+static JJLTimeZoneHandle JJLInsertTimeZone(const char *name, int32_t length, uint64_t hash, JJLTimeZoneLoader load, void *info) {
+    while (sCount >= sCapacity && JJLEvictLeastRecentlyUsed()) {
+    }
+    if (sCount >= JJL_REGISTRY_MAX_COUNT) {
+        return -1;
+    }
+    char *nameCopy = malloc(length);
+    if (!nameCopy) {
+        return -1;
+    }
+    memcpy(nameCopy, name, length);
+
+    int32_t probeLength = 0;
+    JJLTimeZoneHandle handle = hash & (JJL_REGISTRY_CAPACITY - 1);
+    // There's always one that isn't live, since the table is never more than JJL_REGISTRY_MAX_COUNT full
+    uint64_t state = __atomic_load_n(&sEntries[handle].state, __ATOMIC_RELAXED);
+    while (JJLEntryStatus(state) != kJJLEntryEmpty && JJLEntryStatus(state) != kJJLEntryEvicted) {
+        handle = (handle + 1) & (JJL_REGISTRY_CAPACITY - 1);
+        state = __atomic_load_n(&sEntries[handle].state, __ATOMIC_RELAXED);
+        probeLength++;
+    }
+    JJLRegistryEntry *entry = &sEntries[handle];
+    entry->length = length;
+    entry->name = nameCopy;
+    // Names that don't load are kept too, so that they aren't looked for on disk again every time
+    entry->timeZone = JJLLoadTimeZone(name, length, load, info);
+    __atomic_store_n(&entry->hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->lastUsed, sMisses, __ATOMIC_RELAXED);
+    // An empty entry's generation is 0, and an evicted one's was bumped when it was evicted. Publishing the entry also publishes its zone
+    __atomic_store_n(&entry->state, (state & ~(uint64_t)UINT32_MAX) | (kJJLEntryLive + 1), __ATOMIC_RELEASE);
+    if (probeLength + 1 > sMaxProbeLength) {
+        __atomic_store_n(&sMaxProbeLength, probeLength + 1, __ATOMIC_RELEASE);
+    }
+    sCount++;
+    return handle;
+}
+
+JJLTimeZoneHandle JJLAcquireTimeZoneHandle(const char *name, int32_t length) {
+    return JJLAcquireTimeZoneHandleWithLoader(name, length, NULL, NULL);
+}
+
+JJLTimeZoneHandle JJLAcquireTimeZoneHandleWithLoader(const char *name, int32_t length, JJLTimeZoneLoader load, void *info) {
+    char canonicalName[8];
+    int32_t offset = 0;
+    if (JJLFixedOffsetForTimeZoneName(name, length, &offset)) {
+        length = JJLCanonicalFixedOffsetName(canonicalName, offset);
+        name = canonicalName;
+    }
+    uint64_t hash = JJLHashName(name, length);
+    JJLTimeZoneHandle handle = JJLPinTimeZoneHandle(name, length, hash);
+    if (handle >= 0) {
+        JJLRegistryEntry *entry = &sEntries[handle];
+        __atomic_fetch_add(&entry->hits, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->lastUsed, __atomic_load_n(&sMisses, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        return handle;
+    }
+
+    pthread_mutex_lock(&sRegistryLock);
+    // Another thread may have added it in the meantime
+    handle = JJLPinTimeZoneHandle(name, length, hash);
+    if (handle >= 0) {
+        __atomic_fetch_add(&sEntries[handle].hits, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&sMisses, sMisses + 1, __ATOMIC_RELAXED);
+        handle = JJLInsertTimeZone(name, length, hash, load, info);
+    }
+    pthread_mutex_unlock(&sRegistryLock);
+    return handle;
+}
+
+void JJLReleaseTimeZoneHandle(JJLTimeZoneHandle handle) {
+    if (handle < 0) {
+        return;
+    }
+    JJLRegistryEntry *entry = &sEntries[handle];
+    __atomic_store_n(&entry->lastUsed, __atomic_load_n(&sMisses, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&entry->state, 1, __ATOMIC_RELEASE);
+}
+
+timezone_t JJLTimeZoneForHandle(JJLTimeZoneHandle handle) {
+    // The entry can't change while it's pinned, and pinning it synchronized with its publication
+    return handle >= 0 ? sEntries[handle].timeZone : NULL;
+}
+
+JJLTimeZoneCacheStatistics JJLGetTimeZoneCacheStatistics(void) {
+    pthread_mutex_lock(&sRegistryLock);
+    uint64_t hits = sEvictedHits;
+    for (int32_t i = 0; i < JJL_REGISTRY_CAPACITY; i++) {
+        hits += __atomic_load_n(&sEntries[i].hits, __ATOMIC_RELAXED);
+    }
+    JJLTimeZoneCacheStatistics statistics = {
+        .hits = hits,
+        .misses = sMisses,
+        .evictions = sEvictions,
+        .count = sCount,
+        .capacity = sCapacity,
+    };
+    pthread_mutex_unlock(&sRegistryLock);
+    return statistics;
+}
+
+void JJLSetTimeZoneCacheCapacity(int32_t capacity) {
+    pthread_mutex_lock(&sRegistryLock);
+    sCapacity = capacity < 1 ? 1 : capacity > JJL_REGISTRY_MAX_COUNT ? JJL_REGISTRY_MAX_COUNT : capacity;
+    while (sCount > sCapacity && JJLEvictLeastRecentlyUsed()) {
+    }
+    pthread_mutex_unlock(&sRegistryLock);
+}
@@ -11,11 +11,122 @@
 
 static const int32_t kJJLMaxDateLength = 50; // Extra to be safe
 
+// The format options compiled into the ordered list of fields and separators to write or read. Plans are immutable once created, so one can be
+// used from any number of threads at once.
+typedef struct JJLFormatPlan JJLFormatPlan;
+// The digits of fractional seconds that Apple's formatter uses, i.e. milliseconds
+static const int32_t kJJLDefaultFractionalSecondDigits = 3;
+
+JJLFormatPlan *JJLCreateFormatPlan(CFISO8601DateFormatOptions options);
+// Same as JJLCreateFormatPlan, but with fractional seconds (when the options include them) written with the given number of digits, from 0 (none)
+// to 9, and read to that precision, with any further digits ignored. Returns NULL if the number of digits is out of range.
+JJLFormatPlan *JJLCreateFormatPlanWithFractionalSecondDigits(CFISO8601DateFormatOptions options, int32_t fractionalSecondDigits);
+void JJLDestroyFormatPlan(JJLFormatPlan *plan);
+// The most bytes that formatting a single date with the plan can write
+int32_t JJLMaxLengthForFormatPlan(const JJLFormatPlan *plan);
+
 // Core functions for date formatting
-void JJLFillBufferForDate(char *buffer, double timeInSeconds, CFISO8601DateFormatOptions options, timezone_t timeZone, double fallbackOffset);
+// Writes the date into buffer (which must be at least kJJLMaxDateLength long) and returns the number of bytes written. No NUL terminator is written.
+int32_t JJLFillBufferForDate(char *buffer, double timeInSeconds, CFISO8601DateFormatOptions options, timezone_t timeZone, double fallbackOffset);
+// Same as JJLFillBufferForDate, but with the options already compiled. buffer only needs to be JJLMaxLengthForFormatPlan(plan) long.
+int32_t JJLFillBufferForDateWithPlan(char *buffer, double timeInSeconds, const JJLFormatPlan *plan, timezone_t timeZone, double fallbackOffset);
+// Integer versions of JJLFillBufferForDateWithPlan, which are exact at any magnitude, though nothing is written for a time whose year doesn't fit in
+// an int. The fractional seconds shown are the nanoseconds truncated (e.g. 999999999 shows as .999), and out of range nanoseconds carry into the
+// seconds (nothing is written if that overflows). The counts of milli/micro/nanoseconds since 1970 can be negative.
+int32_t JJLFillBufferForEpochSeconds(char *buffer, int64_t seconds, int32_t nanoseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset);
+int32_t JJLFillBufferForEpochMillis(char *buffer, int64_t milliseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset);
+int32_t JJLFillBufferForEpochMicros(char *buffer, int64_t microseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset);
+int32_t JJLFillBufferForEpochNanos(char *buffer, int64_t nanoseconds, const JJLFormatPlan *plan, timezone_t timeZone, int32_t fallbackOffset);
+// Batch version of JJLFillBufferForDateWithPlan. The strings are packed back to back into buffer, which must be at least count * JJLMaxLengthForFormatPlan(plan) long,
+// and offsets (count + 1 entries) is filled Arrow-style, so that string i is [offsets[i], offsets[i + 1]).
+// fallbackOffsets is either NULL or has one offset per date. Returns the total number of bytes written. Since the offsets are 32-bit,
+// count * JJLMaxLengthForFormatPlan(plan) must be at most INT32_MAX, so split larger batches.
+int32_t JJLFillBufferForDates(char *buffer, const double *timesInSeconds, int32_t count, const JJLFormatPlan *plan, timezone_t timeZone, const double *fallbackOffsets, int32_t *offsets);
+// A context remembers the last string it formatted, so that formatting a run of nearby times (e.g. log timestamps) only rewrites the fractional
+// seconds when the next time is in the same second, and only the time of day when it's in the same day and UTC offset. A context isn't thread-safe,
+// but any number can be used at once, e.g. one per thread, with the same plan and zone. It copies the plan, and the zone must outlive it.
+typedef struct JJLFormatContext JJLFormatContext;
+JJLFormatContext *JJLCreateFormatContext(const JJLFormatPlan *plan, timezone_t timeZone);
+void JJLDestroyFormatContext(JJLFormatContext *context);
+// The context's copy of the plan
+const JJLFormatPlan *JJLFormatPlanForContext(const JJLFormatContext *context);
+// Same as JJLFillBufferForEpochSeconds and JJLFillBufferForDateWithPlan, with the context's plan and zone. buffer only needs to be
+// JJLMaxLengthForFormatPlan(plan) long.
+int32_t JJLFillBufferForEpochWithContext(JJLFormatContext *context, char *buffer, int64_t seconds, int32_t nanoseconds);
+int32_t JJLFillBufferForDateWithContext(JJLFormatContext *context, char *buffer, double timeInSeconds);
 double JJLTimeIntervalForString(const char *string, int32_t length, CFISO8601DateFormatOptions options, timezone_t timeZone, _Bool *errorOccurred);
+// Same as JJLTimeIntervalForString, but with the options already compiled
+double JJLTimeIntervalForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, _Bool *errorOccurred);
+// Same as JJLTimeIntervalForStringWithPlan, but exact, since it only uses integer math: returns the whole seconds since 1970 (rounded down) and sets
+// *nanoseconds to the fraction of a second, in [0, 1e9) and truncated to the plan's precision.
+int64_t JJLEpochSecondsForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, int32_t *nanoseconds, _Bool *errorOccurred);
+// Same as JJLEpochSecondsForStringWithPlan, but returns nanoseconds since 1970. If the string parses but that doesn't fit in an int64_t (before 1677
+// or after 2262), *overflowOccurred is set and 0 is returned.
+int64_t JJLEpochNanosForStringWithPlan(const char *string, int32_t length, const JJLFormatPlan *plan, timezone_t timeZone, _Bool *errorOccurred, _Bool *overflowOccurred);
+// A context remembers how the last string it parsed started, so that in a sorted stream of strings (e.g. the lines of a log), where the date and
+// usually the hour repeat, only the rest of each one is parsed, and the date isn't converted to days again. Like JJLFormatContext, a context isn't
+// thread-safe, but any number can be used at once. It copies the plan, and the zone must outlive it.
+typedef struct JJLParseContext JJLParseContext;
+JJLParseContext *JJLCreateParseContext(const JJLFormatPlan *plan, timezone_t timeZone);
+void JJLDestroyParseContext(JJLParseContext *context);
+// Same as JJLTimeIntervalForStringWithPlan and JJLEpochSecondsForStringWithPlan, with the context's plan and zone
+double JJLTimeIntervalForStringWithContext(JJLParseContext *context, const char *string, int32_t length, _Bool *errorOccurred);
+int64_t JJLEpochSecondsForStringWithContext(JJLParseContext *context, const char *string, int32_t length, int32_t *nanoseconds, _Bool *errorOccurred);
+// Batch version of JJLTimeIntervalForStringWithPlan. The input is Arrow-style: string i is [buffer + offsets[i], buffer + offsets[i + 1]), and need not be NUL-terminated.
+// Bit i of validity (least significant bit first, (count + 7) / 8 bytes) is set if string i parsed, in which case results[i] holds its time interval.
+// Otherwise results[i] is 0. Returns the number of strings that parsed.
+int32_t JJLTimeIntervalsForStrings(const char *buffer, const int32_t *offsets, int32_t count, const JJLFormatPlan *plan, timezone_t timeZone, double *results, uint8_t *validity);
 void JJLPerformInitialSetup(void);
 
+// A process-wide cache of zones by name, which loads each one the first time it's asked for. Looking up a name that's in it takes no locks or
+// allocation. A handle pins its zone, so that it isn't evicted until the handle is released, and handles that are kept skip even the lookup.
+// Once there are more zones than the cache's capacity, loading another evicts the least recently used one that isn't pinned and frees it.
+typedef int32_t JJLTimeZoneHandle;
+// Returns a pinned handle for the name (which needn't be NUL-terminated), or -1 if the cache is full of pinned zones. A name that isn't
+// a zone still gets a handle, for which JJLTimeZoneForHandle returns NULL. Every handle that isn't -1 must be released once.
+JJLTimeZoneHandle JJLAcquireTimeZoneHandle(const char *name, int32_t length);
+// Makes the zone for a name that the time zone files don't have, e.g. from the system's own time zone API, or returns NULL if it can't.
+// It's called with the cache locked, so it mustn't use the cache itself.
+typedef timezone_t (*JJLTimeZoneLoader)(const char *name, int32_t length, void *info);
+// Same as JJLAcquireTimeZoneHandle, but when the name isn't cached and the files don't have it, its zone is what load makes of it
+JJLTimeZoneHandle JJLAcquireTimeZoneHandleWithLoader(const char *name, int32_t length, JJLTimeZoneLoader load, void *info);
+void JJLReleaseTimeZoneHandle(JJLTimeZoneHandle handle);
+// The zone for a pinned handle, which is valid until the handle is released
+timezone_t JJLTimeZoneForHandle(JJLTimeZoneHandle handle);
+typedef struct {
+    // Lookups of names that were in the cache, and of ones that weren't
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // The number of names in the cache, which can go over capacity while more than that are pinned
+    int32_t count;
+    int32_t capacity;
+} JJLTimeZoneCacheStatistics;
+JJLTimeZoneCacheStatistics JJLGetTimeZoneCacheStatistics(void);
+// Sets the number of zones to keep, from 1 to 3072 (the default is 1024), evicting any over it that aren't pinned
+void JJLSetTimeZoneCacheCapacity(int32_t capacity);
+// Sets *offset to the seconds east of UTC for "GMT", "GMT+HH", "GMT+HHMM" or "GMT+HH:MM" (or "-"), which is what TimeZone(secondsFromGMT:)
+// and the like are named, and returns false for any other name
+_Bool JJLFixedOffsetForTimeZoneName(const char *name, int32_t length, int32_t *offset);
+
+// For publishing an object that's immutable once it's shared: a load that returns what a store wrote also sees everything written before the store
+static inline void *JJLAtomicLoadPointer(void *const *pointer) {
+    return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+}
+
+static inline void JJLAtomicStorePointer(void **pointer, void *value) {
+    __atomic_store_n(pointer, value, __ATOMIC_RELEASE);
+}
+
+// For freeing such an object once it's been replaced, when readers use it without retaining it: a reader loads it and uses it between
+// JJLEnterReadSection and JJLExitReadSection (which nest), and a writer that has stored the replacement passes the old one to JJLRetire,
+// which calls release on it once every read section that could have loaded it has been exited. Retired objects are released by later calls
+// to JJLRetire or JJLReclaimRetired, on whichever thread makes them.
+void JJLEnterReadSection(void);
+void JJLExitReadSection(void);
+void JJLRetire(void *object, void (*release)(void *object));
+void JJLReclaimRetired(void);
+
 // Testing injection functions for EINTR retry logic
 typedef ssize_t (*JJLReadFunction)(int fd, void *buffer, size_t nbytes);
 typedef int (*JJLOpenFunctionNonVariadic)(const char *path, int mode);
@@ -3,6 +3,7 @@
 #ifndef TZDB_H
 #define TZDB_H
 
+#include <stdbool.h>
 #include <time.h>
 
 // Timezone type from tzdb
@@ -10,8 +11,44 @@ typedef struct state *timezone_t;
 
 // Timezone API functions (implemented in localtime.c)
 timezone_t jjl_tzalloc(char const *name);
+// Allocates a zone from a POSIX TZ string, e.g. "EST5EDT,M3.2.0,M11.1.0" or "<+0530>-5:30", without looking for a time zone file of that
+// name like jjl_tzalloc does. Its transitions are computed from the string's rule for each year as it's needed, rather than stored.
+// Returns NULL with errno set if the string can't be parsed.
+timezone_t jjl_tzalloc_posix(char const *tz);
+// Allocates a zone that's always utoff seconds east of UTC, e.g. for TimeZone(secondsFromGMT:), which needs no lookup to convert times.
+// Returns NULL with errno set if utoff isn't less than a day either way.
+timezone_t jjl_tzalloc_fixed(long utoff);
+// Allocates a zone from its history, e.g. for one that the system's time zone API has but the files don't. It's initialutoff seconds east
+// of UTC (daylight saving time if initialisdst) until ats[0], and utoffs[i] (DST if isdsts[i]) from ats[i] on, for the count increasing
+// times in ats. After the last, it follows rule if that isn't NULL, a POSIX TZ string like "EST5EDT,M3.2.0,M11.1.0", and otherwise stays
+// at the last offset. Returns NULL with errno set if the history doesn't fit in a zone or rule can't be parsed.
+timezone_t jjl_tzalloc_transitions(long initialutoff, bool initialisdst, time_t const *ats, long const *utoffs, bool const *isdsts, int count,
+                                   char const *rule);
+// Writes to buf (size bytes) the POSIX TZ string for a zone that changes to DST and back every year like the last two of the transitions
+// (as jjl_tzalloc_transitions takes them) do, for extending them. Returns false if they aren't a change to DST and back within a year,
+// or if the string doesn't fit. The rule is only inferred, so check it against the zone's later transitions if they're known.
+bool jjl_tzrule_infer(char *buf, size_t size, time_t const *ats, long const *utoffs, bool const *isdsts, int count);
 void jjl_tzfree(timezone_t sp);
 struct tm * jjl_localtime_rz(timezone_t sp, time_t const *timep, struct tm *tmp);
 time_t jjl_mktime_z(timezone_t sp, struct tm *tmp);
+// Converts a wall clock time in the zone (seconds since 1970 as if the zone were UTC) to UTC with a single lookup. A wall time
+// that's skipped by a transition is moved forward by the gap, and one that's repeated resolves to the later instant. Returns false
+// if the zone can't do this directly (leap seconds, or a time beyond its transitions where the rules repeat), in which case use jjl_mktime_z.
+bool jjl_wall_to_utc_z(timezone_t sp, time_t wallTime, time_t *utcTime);
+// Sets [*start, *end) to a range of times including t in which the zone's offset, abbreviation and DST flag stay the same as at t, so that
+// callers can cache what jjl_localtime_rz gives for t and get any other time in the range by adding the difference. The range may be shorter
+// than the whole period, e.g. only t's second, but never longer.
+void jjl_offset_range_z(timezone_t sp, time_t t, time_t *start, time_t *end);
+
+// Snapshots are single files of precompiled zones, which every process that maps one shares the pages of (see the tzsnapshot tool).
+// Writes the named zones to a snapshot at path, skipping any that can't be loaded, and returns how many were written, or -1 with errno set.
+int jjl_tzsnapshot_write(char const *path, char const *const *names, int count);
+// Maps the snapshot at path, after which jjl_tzalloc takes the zones in it from there rather than loading them. Like tzset, call it before
+// other threads allocate zones. Returns false with errno set if the snapshot can't be used, e.g. if it was written by a different kind of build.
+bool jjl_tzsnapshot_open(char const *path);
+// Writes the named zones, skipping any that can't be loaded, as C tables to the header at path. Building the library with JJL_TZ_EMBEDDED
+// defined and that header at Sources/tzdb/tzembedded.h compiles the zones in, so that jjl_tzalloc needs no file system access or allocation
+// for them. Returns the number of zones written, or -1 with errno set.
+int jjl_tzembed_write(char const *path, char const *const *names, int count);
 
 #endif /* TZDB_H */
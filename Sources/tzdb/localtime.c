@@ -18,6 +18,9 @@
 
 #include "tzfile__.h"
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
 
 #if defined THREAD_SAFE && THREAD_SAFE
 # include <pthread.h>
@@ -121,21 +124,32 @@ struct lsinfo {				/* leap second information */
 #define MY_TZNAME_MAX	255
 #endif /* !defined TZNAME_MAX */
 
-struct state {
-	int		leapcnt;
-	int		timecnt;
-	int		typecnt;
-	int		charcnt;
-	bool		goback;
-	bool		goahead;
-	time_t		ats[TZ_MAX_TIMES];
-	unsigned char	types[TZ_MAX_TIMES];
-	struct ttinfo	ttis[TZ_MAX_TYPES];
-	char		chars[BIGGEST(BIGGEST(TZ_MAX_CHARS + 1, sizeof gmt),
-				(2 * (MY_TZNAME_MAX + 1)))];
-	struct lsinfo	lsis[TZ_MAX_LEAPS];
-	int		defaulttype; /* for early times or if no transitions */
-};
+/*
+** JJL: Each zone has dense indexes over ats and wallats for the years that
+** nearly all dates fall in, so that finding the transition in effect at a time
+** is an array read plus (almost always) at most one comparison, instead of a
+** binary search. Bucket b starts at indexstart + (b << JJL_INDEX_BUCKET_SHIFT)
+** and holds the number of transitions before that. 2^21 seconds is a bit over
+** 24 days, less than the time between transitions in practice; more than one
+** in a bucket still works, it just takes a longer scan. The buckets before the
+** first transition and after the last are left out, and times outside the
+** buckets fall back to a binary search.
+*/
+#ifndef JJL_INDEX_FIRST_YEAR
+#define JJL_INDEX_FIRST_YEAR	1900
+#endif
+#ifndef JJL_INDEX_LAST_YEAR
+#define JJL_INDEX_LAST_YEAR	2100
+#endif
+#ifndef JJL_INDEX_BUCKET_SHIFT
+#define JJL_INDEX_BUCKET_SHIFT	21
+#endif
+#define JJL_INDEX_BUCKETS \
+	((int) (((int_fast64_t) (JJL_INDEX_LAST_YEAR - JJL_INDEX_FIRST_YEAR + 1) \
+		 * DAYSPERLYEAR * SECSPERDAY >> JJL_INDEX_BUCKET_SHIFT) + 1))
+
+#define STATE_CHARS_SIZE	BIGGEST(BIGGEST(TZ_MAX_CHARS + 1, sizeof gmt), \
+					(2 * (MY_TZNAME_MAX + 1)))
 
 enum r_type {
   JULIAN_DAY,		/* Jn = Julian day */
@@ -151,15 +165,113 @@ struct rule {
 	int_fast32_t	r_time;		/* transition time of rule */
 };
 
+/*
+** JJL: A zone whose transitions end with a POSIX TZ rule, as from a TZif
+** file's footer or a TZ string, keeps the rule rather than two transitions a
+** year for 400 years. Each year's two are computed from the rule when a time
+** in it is looked up, and kept in a small cache in the state, indexed by the
+** year's low bits.
+*/
+#ifndef JJL_RULE_CACHE_SIZE
+#define JJL_RULE_CACHE_SIZE	8	/* a power of two */
+#endif
+
+/*
+** JJL: The arrays of a state are sized to fit its zone, and allocated in one
+** block right after it by jjl_compact_state, in the order an offset lookup
+** reads them, with the abbreviations and leap seconds last. Zones are loaded
+** into a full_state, whose arrays have room for any zone, and then compacted.
+*/
+struct state {
+	int		leapcnt;
+	int		timecnt;
+	int		typecnt;
+	int		charcnt;
+	bool		goback;
+	bool		goahead;
+	int		defaulttype; /* for early times or if no transitions */
+	/* JJL: wall clock time at which each transition's type takes effect */
+	bool		haswallats;
+	int		indexcnt;
+	time_t		indexstart;
+	/* JJL: past the last transition (throughout, if there are none), the
+	   zone follows a rule from standard time (ruletypes[1]) to DST
+	   (ruletypes[0]) at rulestart and back at ruleend */
+	bool		hasrule;
+	unsigned char	ruletypes[2];
+	struct rule	rulestart;
+	struct rule	ruleend;
+	/* Written by lookups, even of a state that's shared; see
+	   jjl_rule_year_cached */
+	uint_least64_t	rulecache[JJL_RULE_CACHE_SIZE][2];
+	uint_least16_t	*atsindex;
+	time_t		*ats;
+	unsigned char	*types;
+	struct ttinfo	*ttis;
+	uint_least16_t	*wallatsindex;
+	time_t		*wallats;
+	char		*chars;
+	struct lsinfo	*lsis;
+};
+
+struct full_state {
+	struct state	st;
+	uint_least16_t	atsindex[JJL_INDEX_BUCKETS];
+	time_t		ats[TZ_MAX_TIMES];
+	unsigned char	types[TZ_MAX_TIMES];
+	struct ttinfo	ttis[TZ_MAX_TYPES];
+	uint_least16_t	wallatsindex[JJL_INDEX_BUCKETS];
+	time_t		wallats[TZ_MAX_TIMES];
+	char		chars[STATE_CHARS_SIZE];
+	struct lsinfo	lsis[TZ_MAX_LEAPS];
+};
+
+/* Point the state in FSP at FSP's arrays, and return it.  */
+static struct state *
+full_state_init(struct full_state *fsp)
+{
+	register struct state *	sp = &fsp->st;
+
+	sp->atsindex = fsp->atsindex;
+	sp->ats = fsp->ats;
+	sp->types = fsp->types;
+	sp->ttis = fsp->ttis;
+	sp->wallatsindex = fsp->wallatsindex;
+	sp->wallats = fsp->wallats;
+	sp->chars = fsp->chars;
+	sp->lsis = fsp->lsis;
+	return sp;
+}
+
+/* JJL: Have SP follow the rule from START to END after its last transition,
+   with DSTTYPE and STDTYPE as the types it changes to.  */
+static void
+jjl_set_rule(struct state *sp, struct rule const *start,
+	     struct rule const *end, int dsttype, int stdtype)
+{
+	sp->hasrule = true;
+	sp->rulestart = *start;
+	sp->ruleend = *end;
+	sp->ruletypes[0] = dsttype;
+	sp->ruletypes[1] = stdtype;
+	/* The rule repeats rather than the transitions.  */
+	sp->goahead = false;
+	memset(sp->rulecache, 0, sizeof sp->rulecache);
+}
+
 static struct tm *gmtsub(struct state const *, time_t const *, int_fast32_t,
 			 struct tm *);
+static int_fast64_t jjl_civil_to_days(int_fast64_t, int, int);
+static void jjl_days_to_civil(int_fast64_t, int_fast64_t *, int *, int *,
+			      int *);
 static bool increment_overflow(int *, int);
 static bool increment_overflow_time(time_t *, int_fast32_t);
 static bool normalize_overflow32(int_fast32_t *, int *, int);
 static struct tm *timesub(time_t const *, int_fast32_t, struct state const *,
 			  struct tm *);
 static bool typesequiv(struct state const *, int, int);
-static bool tzparse(char const *, struct state *, bool);
+static bool tzparse(char const *, struct state *, bool,
+		    struct state const *);
 
 #ifdef ALL_STATE
 static struct state *	lclptr;
@@ -167,10 +279,10 @@ static struct state *	gmtptr;
 #endif /* defined ALL_STATE */
 
 #ifndef ALL_STATE
-static struct state	lclmem;
-static struct state	gmtmem;
-#define lclptr		(&lclmem)
-#define gmtptr		(&gmtmem)
+static struct full_state	lclmem;
+static struct full_state	gmtmem;
+#define lclptr		(&lclmem.st)
+#define gmtptr		(&gmtmem.st)
 #endif /* State Farm */
 
 #ifndef TZ_STRLEN_MAX
@@ -313,6 +425,13 @@ settzname(void)
 #if USG_COMPAT
 		if (ttisp->tt_isdst)
 			daylight = 1;
+#endif
+	}
+	if (sp->hasrule) {
+		update_tzname_etc(sp, &sp->ttis[sp->ruletypes[1]]);
+		update_tzname_etc(sp, &sp->ttis[sp->ruletypes[0]]);
+#if USG_COMPAT
+		daylight = 1;
 #endif
 	}
 }
@@ -348,16 +467,6 @@ differ_by_repeat(const time_t t1, const time_t t0)
 	return t1 - t0 == SECSPERREPEAT;
 }
 
-/* Input buffer for data read from a compiled tz file.  */
-union input_buffer {
-  /* The first part of the buffer, interpreted as a header.  */
-  struct tzhead tzhead;
-
-  /* The entire buffer.  */
-  char buf[2 * sizeof(struct tzhead) + 2 * sizeof (struct state)
-	   + 4 * TZ_MAX_TIMES];
-};
-
 /* TZDIR with a trailing '/' rather than a trailing '\0'.  */
 static char const tzdirslash[sizeof TZDIR] = TZDIR "/";
 
@@ -365,11 +474,11 @@ static char const tzdirslash[sizeof TZDIR] = TZDIR "/";
 union local_storage {
   /* The results of analyzing the file's contents after it is opened.  */
   struct file_analysis {
-    /* The input buffer.  */
-    union input_buffer u;
+    /* The TZ string at the end of the file, NUL-terminated.  */
+    char tzstring[TZ_STRLEN_MAX + 1];
 
     /* A temporary state used for parsing a TZ string in the file.  */
-    struct state st;
+    struct full_state st;
   } u;
 
   /* The file name to be opened.  */
@@ -423,14 +532,13 @@ int JJLSafeOpenInjectionNonVariadic(const char *path, int mode, int (*openPtr)(c
     }
 }
 
-bool JJLGoodVersion(const char *name) {
-    int fd = JJLSafeOpen(name, OPEN_MODE);
-    char header[5];
-    JJLSafeRead(fd, header, sizeof(header));
-    close(fd);
+bool JJLGoodVersion(const char *header) {
     return memcmp(header, "TZif", 4) == 0 && (header[4] == '2' || header[4] == '1' || header[4] == '\0');
 }
 
+static int tzloaddata(char const *buf, ssize_t nread, struct state *sp,
+		      bool doextend, union local_storage *lsp);
+
 /* Load tz data from the file named NAME into *SP.  Read extended
    format if DOEXTEND.  Use *LSP for temporary storage.  Return 0 on
    success, an errno value on failure.  */
@@ -438,15 +546,15 @@ static int
 tzloadbody(char const *name, struct state *sp, bool doextend,
 	   union local_storage *lsp)
 {
-	register int			i;
 	register int			fid;
-	register int			stored;
-	register ssize_t		nread;
+	register int			err;
 	register bool doaccess;
-	register union input_buffer *up = &lsp->u.u;
-	register int tzheadsize = sizeof (struct tzhead);
+	struct stat			st;
+	size_t				size;
+	void *				map;
 
 	sp->goback = sp->goahead = false;
+	sp->hasrule = false;
 
 	if (! name) {
 		name = TZDEFAULT;
@@ -481,31 +589,69 @@ tzloadbody(char const *name, struct state *sp, bool doextend,
 	}
 	if (doaccess && access(name, R_OK) != 0)
 	  return errno;
-    if (!JJLGoodVersion(name)) {
-        return EINVAL;
-    }
 	fid = JJLSafeOpen(name, OPEN_MODE);
 	if (fid < 0)
 	  return errno;
 
-	nread = JJLSafeRead(fid, up->buf, sizeof up->buf);
-	if (nread < tzheadsize) {
-	  int err = nread < 0 ? errno : EINVAL;
+	/* JJL: Map the file instead of reading it into a buffer, and decode
+	   straight from the mapping.  It's still all decoded into *SP up
+	   front rather than on demand: lookups binary search native
+	   time_t arrays (and their index), transitions out of time_t range
+	   are dropped or merged while decoding, and the mapping is unmapped
+	   once the zone is compacted, so that a loaded zone holds no file
+	   descriptor or mapping.  */
+	if (fstat(fid, &st) != 0) {
+	  err = errno;
 	  close(fid);
 	  return err;
 	}
-	if (close(fid) < 0)
-	  return errno;
+	if (st.st_size < (off_t) sizeof (struct tzhead)
+	    || SSIZE_MAX < st.st_size) {
+	  close(fid);
+	  return EINVAL;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fid, 0);
+	err = map == MAP_FAILED ? errno : 0;
+	if (close(fid) < 0 && err == 0)
+	  err = errno;
+	if (map == MAP_FAILED)
+	  return err;
+	if (err == 0)
+	  err = (JJLGoodVersion(map)
+		 ? tzloaddata(map, size, sp, doextend, lsp)
+		 : EINVAL);
+	munmap(map, size);
+	return err;
+}
+
+/* Decode the NREAD bytes of tz data at BUF into *SP.  */
+static int
+tzloaddata(char const *buf, ssize_t nread, struct state *sp, bool doextend,
+	   union local_storage *lsp)
+{
+	register int			i;
+	register int			stored;
+	register int tzheadsize = sizeof (struct tzhead);
+
 	for (stored = 4; stored <= 8; stored *= 2) {
-		int_fast32_t ttisstdcnt = detzcode(up->tzhead.tzh_ttisstdcnt);
-		int_fast32_t ttisgmtcnt = detzcode(up->tzhead.tzh_ttisgmtcnt);
+		struct tzhead const *hp = (struct tzhead const *) buf;
+		int_fast32_t ttisstdcnt, ttisgmtcnt;
 		int_fast64_t prevtr = 0;
 		int_fast32_t prevcorr = 0;
-		int_fast32_t leapcnt = detzcode(up->tzhead.tzh_leapcnt);
-		int_fast32_t timecnt = detzcode(up->tzhead.tzh_timecnt);
-		int_fast32_t typecnt = detzcode(up->tzhead.tzh_typecnt);
-		int_fast32_t charcnt = detzcode(up->tzhead.tzh_charcnt);
-		char const *p = up->buf + tzheadsize;
+		int_fast32_t leapcnt, timecnt, typecnt, charcnt;
+		int_fast32_t datasize;
+		char const *p = buf + tzheadsize;
+		/* JJL: BUF is the mapped file, not a buffer with room for a
+		   header, so check that there is one before decoding it.  */
+		if (nread < tzheadsize)
+		  return EINVAL;
+		ttisstdcnt = detzcode(hp->tzh_ttisstdcnt);
+		ttisgmtcnt = detzcode(hp->tzh_ttisgmtcnt);
+		leapcnt = detzcode(hp->tzh_leapcnt);
+		timecnt = detzcode(hp->tzh_timecnt);
+		typecnt = detzcode(hp->tzh_typecnt);
+		charcnt = detzcode(hp->tzh_charcnt);
 		if (! (0 <= leapcnt && leapcnt < TZ_MAX_LEAPS
 		       && 0 < typecnt && typecnt < TZ_MAX_TYPES
 		       && 0 <= timecnt && timecnt < TZ_MAX_TIMES
@@ -513,16 +659,25 @@ tzloadbody(char const *name, struct state *sp, bool doextend,
 		       && (ttisstdcnt == typecnt || ttisstdcnt == 0)
 		       && (ttisgmtcnt == typecnt || ttisgmtcnt == 0)))
 		  return EINVAL;
-		if (nread
-		    < (tzheadsize		/* struct tzhead */
-		       + timecnt * stored	/* ats */
-		       + timecnt		/* types */
-		       + typecnt * 6		/* ttinfos */
-		       + charcnt		/* chars */
-		       + leapcnt * (stored + 4)	/* lsinfos */
-		       + ttisstdcnt		/* ttisstds */
-		       + ttisgmtcnt))		/* ttisgmts */
+		datasize = (tzheadsize		/* struct tzhead */
+			    + timecnt * stored	/* ats */
+			    + timecnt		/* types */
+			    + typecnt * 6		/* ttinfos */
+			    + charcnt		/* chars */
+			    + leapcnt * (stored + 4)	/* lsinfos */
+			    + ttisstdcnt		/* ttisstds */
+			    + ttisgmtcnt);		/* ttisgmts */
+		if (nread < datasize)
 		  return EINVAL;
+		/*
+		** JJL: The 64-bit data that follows version 1 data replaces
+		** it, so don't bother decoding the latter.
+		*/
+		if (stored == 4 && hp->tzh_version[0] != '\0') {
+			buf += datasize;
+			nread -= datasize;
+			continue;
+		}
 		sp->leapcnt = leapcnt;
 		sp->timecnt = timecnt;
 		sp->typecnt = typecnt;
@@ -632,19 +787,21 @@ tzloadbody(char const *name, struct state *sp, bool doextend,
 		/*
 		** If this is an old file, we're done.
 		*/
-		if (up->tzhead.tzh_version[0] == '\0')
+		if (hp->tzh_version[0] == '\0')
 			break;
-		nread -= p - up->buf;
-		memmove(up->buf, p, nread);
+		nread -= p - buf;
+		buf = p;
 	}
 	if (doextend && nread > 2 &&
-		up->buf[0] == '\n' && up->buf[nread - 1] == '\n' &&
+		buf[0] == '\n' && buf[nread - 1] == '\n' &&
+		nread - 2 < (ssize_t) sizeof lsp->u.tzstring &&
 		sp->typecnt + 2 <= TZ_MAX_TYPES) {
-			struct state	*ts = &lsp->u.st;
+			struct state	*ts = full_state_init(&lsp->u.st);
 
-			up->buf[nread - 1] = '\0';
-			if (tzparse(&up->buf[1], ts, false)
-			    && ts->typecnt == 2) {
+			memcpy(lsp->u.tzstring, &buf[1], nread - 2);
+			lsp->u.tzstring[nread - 2] = '\0';
+			if (tzparse(lsp->u.tzstring, ts, false, sp)
+			    && ts->hasrule) {
 
 			  /* Attempt to reuse existing abbreviations.
 			     Without this, America/Anchorage would be right on
@@ -685,17 +842,11 @@ tzloadbody(char const *name, struct state *sp, bool doextend,
 				       == sp->types[sp->timecnt - 2]))
 			      sp->timecnt--;
 
-			    for (i = 0; i < ts->timecnt; i++)
-			      if (sp->ats[sp->timecnt - 1] < ts->ats[i])
-				break;
-			    while (i < ts->timecnt
-				   && sp->timecnt < TZ_MAX_TIMES) {
-			      sp->ats[sp->timecnt] = ts->ats[i];
-			      sp->types[sp->timecnt] = (sp->typecnt
-							+ ts->types[i]);
-			      sp->timecnt++;
-			      i++;
-			    }
+			    /* JJL: Follow the rule after the last transition,
+			       rather than appending its transitions.  */
+			    jjl_set_rule(sp, &ts->rulestart, &ts->ruleend,
+					 sp->typecnt + ts->ruletypes[0],
+					 sp->typecnt + ts->ruletypes[1]);
 			    sp->ttis[sp->typecnt++] = ts->ttis[0];
 			    sp->ttis[sp->typecnt++] = ts->ttis[1];
 			  }
@@ -708,7 +859,7 @@ tzloadbody(char const *name, struct state *sp, bool doextend,
 					sp->goback = true;
 					break;
 				}
-		for (i = sp->timecnt - 2; i >= 0; --i)
+		for (i = sp->timecnt - 2; i >= 0 && !sp->hasrule; --i)
 			if (typesequiv(sp, sp->types[sp->timecnt - 1],
 				sp->types[i]) &&
 				differ_by_repeat(sp->ats[sp->timecnt - 1],
@@ -1000,7 +1151,7 @@ transtime(const int year, register const struct rule *const rulep,
 	register bool	leapyear;
 	register int_fast32_t value;
 	register int	i;
-	int		d, m1, yy0, yy1, yy2, dow;
+	int		d, dow;
 
 	INITIALIZE(value);
 	leapyear = isleap(year);
@@ -1034,15 +1185,14 @@ transtime(const int year, register const struct rule *const rulep,
 		*/
 
 		/*
-		** Use Zeller's Congruence to get day-of-week of first day of
-		** month.
+		** JJL: Get the day-of-week of the first day of the month from
+		** its day number rather than Zeller's Congruence, whose
+		** divisions truncate toward zero and so go wrong before year
+		** 1, now that rules are evaluated for any year.  1970-01-01
+		** was a Thursday.
 		*/
-		m1 = (rulep->r_mon + 9) % 12 + 1;
-		yy0 = (rulep->r_mon <= 2) ? (year - 1) : year;
-		yy1 = yy0 / 100;
-		yy2 = yy0 % 100;
-		dow = ((26 * m1 - 2) / 10 +
-			1 + yy2 + yy2 / 4 + yy1 / 4 - 2 * yy1) % 7;
+		dow = (jjl_civil_to_days(year, rulep->r_mon - 1, 1)
+		       + EPOCH_WDAY) % DAYSPERWEEK;
 		if (dow < 0)
 			dow += DAYSPERWEEK;
 
@@ -1079,13 +1229,36 @@ transtime(const int year, register const struct rule *const rulep,
 	return value + rulep->r_time + offset;
 }
 
+/*
+** JJL: Set *STARTP and *ENDP to the times from the start of YEAR (in UT) at
+** which SP's rule changes to DST and back. Return whether it changes that
+** year, which, as tzparse has always had it, it doesn't if the change back
+** isn't after the change to DST, or DST would last the whole year.
+*/
+static bool
+jjl_rule_year(struct state const *sp, int year, int_fast32_t *startp,
+	      int_fast32_t *endp)
+{
+	int_fast32_t	stdoffset = -sp->ttis[sp->ruletypes[1]].tt_gmtoff;
+	int_fast32_t	dstoffset = -sp->ttis[sp->ruletypes[0]].tt_gmtoff;
+	int_fast32_t	yearsecs = year_lengths[isleap(year)] * SECSPERDAY;
+
+	*startp = transtime(year, &sp->rulestart, stdoffset);
+	*endp = transtime(year, &sp->ruleend, dstoffset);
+	return (*endp < *startp
+		|| (*startp < *endp && (*endp - *startp
+					< yearsecs + (stdoffset - dstoffset))));
+}
+
 /*
 ** Given a POSIX section 8-style TZ string, fill in the rule tables as
-** appropriate.
+** appropriate.  BASEP is the zone whose file ends with the string, if any;
+** then TZDEFRULES isn't loaded, and the leap seconds come from BASEP.
 */
 
 static bool
-tzparse(const char *name, struct state *sp, bool lastditch)
+tzparse(const char *name, struct state *sp, bool lastditch,
+	struct state const *basep)
 {
 	const char *			stdname;
 	const char *			dstname;
@@ -1122,11 +1295,18 @@ tzparse(const char *name, struct state *sp, bool lastditch)
 		  return false;
 	}
 	charcnt = stdlen + 1;
-	if (sizeof sp->chars < charcnt)
+	if (STATE_CHARS_SIZE < charcnt)
 	  return false;
-	load_ok = tzload(TZDEFRULES, sp, false) == 0;
-	if (!load_ok)
-		sp->leapcnt = 0;		/* so, we're off a little */
+	if (basep) {
+		load_ok = false;
+		sp->leapcnt = basep->leapcnt;
+		memcpy(sp->lsis, basep->lsis, sp->leapcnt * sizeof *sp->lsis);
+	} else {
+		load_ok = tzload(TZDEFRULES, sp, false) == 0;
+		if (!load_ok)
+			sp->leapcnt = 0;	/* so, we're off a little */
+	}
+	sp->hasrule = false;
 	if (*name != '\0') {
 		if (*name == '<') {
 			dstname = ++name;
@@ -1143,7 +1323,7 @@ tzparse(const char *name, struct state *sp, bool lastditch)
 		if (!dstlen)
 		  return false;
 		charcnt += dstlen + 1;
-		if (sizeof sp->chars < charcnt)
+		if (STATE_CHARS_SIZE < charcnt)
 		  return false;
 		if (*name != '\0' && *name != ',' && *name != ';') {
 			name = getoffset(name, &dstoffset);
@@ -1155,12 +1335,7 @@ tzparse(const char *name, struct state *sp, bool lastditch)
 		if (*name == ',' || *name == ';') {
 			struct rule	start;
 			struct rule	end;
-			register int	year;
-			register int	yearlim;
-			register int	timecnt;
-			time_t		janfirst;
-			int_fast32_t janoffset = 0;
-			int yearbeg;
+			int_fast32_t	starttime, endtime;
 
 			++name;
 			if ((name = getrule(name, &start)) == NULL)
@@ -1172,73 +1347,25 @@ tzparse(const char *name, struct state *sp, bool lastditch)
 			if (*name != '\0')
 			  return false;
 			sp->typecnt = 2;	/* standard time and DST */
-			/*
-			** Two transitions per year, from EPOCH_YEAR forward.
-			*/
 			init_ttinfo(&sp->ttis[0], -dstoffset, true, stdlen + 1);
 			init_ttinfo(&sp->ttis[1], -stdoffset, false, 0);
 			sp->defaulttype = 0;
-			timecnt = 0;
-			janfirst = 0;
-			yearbeg = EPOCH_YEAR;
-
-			do {
-			  int_fast32_t yearsecs
-			    = year_lengths[isleap(yearbeg - 1)] * SECSPERDAY;
-			  yearbeg--;
-			  if (increment_overflow_time(&janfirst, -yearsecs)) {
-			    janoffset = -yearsecs;
-			    break;
-			  }
-			} while (EPOCH_YEAR - YEARSPERREPEAT / 2 < yearbeg);
-
-			yearlim = yearbeg + YEARSPERREPEAT + 1;
-			for (year = yearbeg; year < yearlim; year++) {
-				int_fast32_t
-				  starttime = transtime(year, &start, stdoffset),
-				  endtime = transtime(year, &end, dstoffset);
-				int_fast32_t
-				  yearsecs = (year_lengths[isleap(year)]
-					      * SECSPERDAY);
-				bool reversed = endtime < starttime;
-				if (reversed) {
-					int_fast32_t swap = starttime;
-					starttime = endtime;
-					endtime = swap;
-				}
-				if (reversed
-				    || (starttime < endtime
-					&& (endtime - starttime
-					    < (yearsecs
-					       + (stdoffset - dstoffset))))) {
-					if (TZ_MAX_TIMES - 2 < timecnt)
-						break;
-					sp->ats[timecnt] = janfirst;
-					if (! increment_overflow_time
-					    (&sp->ats[timecnt],
-					     janoffset + starttime))
-					  sp->types[timecnt++] = reversed;
-					else if (janoffset)
-					  sp->defaulttype = reversed;
-					sp->ats[timecnt] = janfirst;
-					if (! increment_overflow_time
-					    (&sp->ats[timecnt],
-					     janoffset + endtime)) {
-					  sp->types[timecnt++] = !reversed;
-					  yearlim = year + YEARSPERREPEAT + 1;
-					} else if (janoffset)
-					  sp->defaulttype = !reversed;
-				}
-				if (increment_overflow_time
-				    (&janfirst, janoffset + yearsecs))
-					break;
-				janoffset = 0;
-			}
-			sp->timecnt = timecnt;
-			if (! timecnt)
+			sp->timecnt = 0;
+			sp->goback = false;
+			/*
+			** JJL: Rather than two transitions per year for 400
+			** years, keep the rule, and compute a year's two when
+			** they're needed. A rule that never changes (because
+			** DST would last all year) is perpetual DST.
+			*/
+			jjl_set_rule(sp, &start, &end, 0, 1);
+			if (! (jjl_rule_year(sp, EPOCH_YEAR, &starttime,
+					     &endtime)
+			       || jjl_rule_year(sp, EPOCH_YEAR + 2,
+						&starttime, &endtime))) {
+				sp->hasrule = false;
 				sp->typecnt = 1;	/* Perpetual DST.  */
-			else if (YEARSPERREPEAT < year - yearbeg)
-				sp->goback = sp->goahead = true;
+			}
 		} else {
 			register int_fast32_t	theirstdoffset;
 			register int_fast32_t	theirdstoffset;
@@ -1344,7 +1471,106 @@ static void
 gmtload(struct state *const sp)
 {
 	if (tzload(gmt, sp, true) != 0)
-		tzparse(gmt, sp, true);
+		tzparse(gmt, sp, true, NULL);
+}
+
+/*
+** JJL: Precompute the transitions in wall clock time, so that a local time can
+** be converted to UTC with one lookup instead of mktime's search. Transition i
+** takes effect at wall time ats[i] + (its UT offset). A wall time in a gap
+** before that gets the previous offset, i.e. is moved forward past the gap, and
+** one in an overlap gets the new offset, i.e. is the later of the two instants.
+** These are ICU's defaults for skipped and repeated wall times.
+** The table isn't used with leap seconds, since wall time then isn't simply
+** t + offset, or if the transitions aren't in order in wall time.
+*/
+static void
+jjl_set_wallats(struct state *sp)
+{
+	register int	i;
+
+	sp->haswallats = sp->leapcnt == 0;
+	for (i = 0; i < sp->timecnt && sp->haswallats; ++i) {
+		sp->wallats[i] = sp->ats[i];
+		if (increment_overflow_time(&sp->wallats[i],
+		    sp->ttis[sp->types[i]].tt_gmtoff)
+		    || (i > 0 && sp->wallats[i] < sp->wallats[i - 1]))
+			sp->haswallats = false;
+	}
+}
+
+static void
+jjl_set_indexes(struct state *sp)
+{
+	register int	b, y, first, last;
+	register int	atcount = 0, wallatcount = 0;
+	time_t		start = 0, end, lo, hi;
+
+	for (y = EPOCH_YEAR; y > JJL_INDEX_FIRST_YEAR; --y)
+		start -= year_lengths[isleap(y - 1)] * SECSPERDAY;
+	for (y = EPOCH_YEAR; y < JJL_INDEX_FIRST_YEAR; ++y)
+		start += year_lengths[isleap(y)] * SECSPERDAY;
+	end = start + ((time_t) JJL_INDEX_BUCKETS << JJL_INDEX_BUCKET_SHIFT);
+	sp->indexstart = start;
+	sp->indexcnt = 0;
+	if (sp->timecnt == 0)
+		return;
+	lo = sp->ats[0];
+	hi = sp->ats[sp->timecnt - 1];
+	if (sp->haswallats) {
+		lo = SMALLEST(lo, sp->wallats[0]);
+		hi = BIGGEST(hi, sp->wallats[sp->timecnt - 1]);
+	}
+	if (hi < start || end <= lo)
+		return;
+	first = lo < start ? 0 : (lo - start) >> JJL_INDEX_BUCKET_SHIFT;
+	last = end <= hi ? JJL_INDEX_BUCKETS - 1
+		: (hi - start) >> JJL_INDEX_BUCKET_SHIFT;
+	sp->indexstart = start + ((time_t) first << JJL_INDEX_BUCKET_SHIFT);
+	sp->indexcnt = last - first + 1;
+	for (b = 0; b < sp->indexcnt; ++b) {
+		time_t bucketstart = sp->indexstart
+			+ ((time_t) b << JJL_INDEX_BUCKET_SHIFT);
+
+		while (atcount < sp->timecnt && sp->ats[atcount] < bucketstart)
+			++atcount;
+		sp->atsindex[b] = atcount;
+		if (sp->haswallats) {
+			while (wallatcount < sp->timecnt
+			    && sp->wallats[wallatcount] < bucketstart)
+				++wallatcount;
+			sp->wallatsindex[b] = wallatcount;
+		}
+	}
+}
+
+/* JJL: The number of TIMES (COUNT of them, in order) that are at or before T */
+static int
+jjl_count_through(time_t const *times, uint_least16_t const *index,
+		  time_t indexstart, int indexcnt, int count, time_t t)
+{
+	register int	lo = 0;
+	register int	hi = count;
+
+	if (indexstart <= t && t < indexstart
+	    + ((time_t) indexcnt << JJL_INDEX_BUCKET_SHIFT)) {
+		lo = index[(t - indexstart) >> JJL_INDEX_BUCKET_SHIFT];
+		while (lo < count && times[lo] <= t)
+			++lo;
+		return lo;
+	}
+	if (count == 0 || t < times[0])
+		return 0;
+	if (times[count - 1] <= t)
+		return count;
+	while (lo < hi) {
+		register int	mid = (lo + hi) >> 1;
+
+		if (t < times[mid])
+			hi = mid;
+		else	lo = mid + 1;
+	}
+	return lo;
 }
 
 /* Initialize *SP to a value appropriate for the TZ setting NAME.
@@ -1361,16 +1587,22 @@ zoneinit(struct state *sp, char const *name)
     sp->typecnt = 0;
     sp->charcnt = 0;
     sp->goback = sp->goahead = false;
+    sp->hasrule = false;
     init_ttinfo(&sp->ttis[0], 0, false, 0);
     strcpy(sp->chars, gmt);
     sp->defaulttype = 0;
+    jjl_set_wallats(sp);
+    jjl_set_indexes(sp);
     return 0;
   } else {
     int err = tzload(name, sp, true);
-    if (err != 0 && name && name[0] != ':' && tzparse(name, sp, false))
+    if (err != 0 && name && name[0] != ':' && tzparse(name, sp, false, NULL))
       err = 0;
-    if (err == 0)
+    if (err == 0) {
       scrub_abbrs(sp);
+      jjl_set_wallats(sp);
+      jjl_set_indexes(sp);
+    }
     return err;
   }
 }
@@ -1385,8 +1617,12 @@ tzsetlcl(char const *name)
       : 0 < lcl_is_set && strcmp(lcl_TZname, name) == 0)
     return;
 #ifdef ALL_STATE
-  if (! sp)
-    lclptr = sp = malloc(sizeof *lclptr);
+  if (! sp) {
+    struct full_state *fsp = malloc(sizeof *fsp);
+    lclptr = sp = fsp ? full_state_init(fsp) : NULL;
+  }
+#else
+  full_state_init(&lclmem);
 #endif /* defined ALL_STATE */
   if (sp) {
     if (zoneinit(sp, name) != 0)
@@ -1432,7 +1668,10 @@ gmtcheck(void)
     return;
   if (! gmt_is_set) {
 #ifdef ALL_STATE
-    gmtptr = malloc(sizeof *gmtptr);
+    struct full_state *fsp = malloc(sizeof *fsp);
+    gmtptr = fsp ? full_state_init(fsp) : NULL;
+#else
+    full_state_init(&gmtmem);
 #endif
     if (gmtptr)
       gmtload(gmtptr);
@@ -1443,24 +1682,1170 @@ gmtcheck(void)
 
 #if NETBSD_INSPIRED
 
+/* JJL: Where the arrays of a state go when sized to fit, after START bytes */
+struct state_layout {
+	size_t	atsindexoff;
+	size_t	atsoff;
+	size_t	typesoff;
+	size_t	ttisoff;
+	size_t	wallatsindexoff;
+	size_t	wallatsoff;
+	size_t	charsoff;
+	size_t	lsisoff;
+	size_t	size;
+	int	ttiscnt;
+	int	wallcnt;
+	int	wallindexcnt;
+	size_t	charssize;
+};
+
+#define JJL_ALIGN_UP(size, type) \
+	(((size) + _Alignof(type) - 1) & ~(_Alignof(type) - 1))
+
+static void
+jjl_layout_state(struct state const *sp, size_t start, struct state_layout *lp)
+{
+	size_t	size;
+
+	lp->wallcnt = sp->haswallats ? sp->timecnt : 0;
+	lp->wallindexcnt = sp->haswallats ? sp->indexcnt : 0;
+	/* zoneinit's fast path leaves typecnt and charcnt 0 while using
+	   ttis[0] and "GMT".  */
+	lp->ttiscnt = BIGGEST(sp->typecnt, 1);
+	lp->charssize = BIGGEST(SMALLEST(sp->charcnt + 1,
+					 (int) STATE_CHARS_SIZE),
+				(int) sizeof gmt);
+
+	lp->atsindexoff = JJL_ALIGN_UP(start, uint_least16_t);
+	size = lp->atsindexoff + sp->indexcnt * sizeof *sp->atsindex;
+	lp->atsoff = JJL_ALIGN_UP(size, time_t);
+	size = lp->atsoff + sp->timecnt * sizeof *sp->ats;
+	lp->typesoff = size;
+	size = lp->typesoff + sp->timecnt * sizeof *sp->types;
+	lp->ttisoff = JJL_ALIGN_UP(size, struct ttinfo);
+	size = lp->ttisoff + lp->ttiscnt * sizeof *sp->ttis;
+	lp->wallatsindexoff = JJL_ALIGN_UP(size, uint_least16_t);
+	size = lp->wallatsindexoff
+		+ lp->wallindexcnt * sizeof *sp->wallatsindex;
+	lp->wallatsoff = JJL_ALIGN_UP(size, time_t);
+	size = lp->wallatsoff + lp->wallcnt * sizeof *sp->wallats;
+	lp->charsoff = size;
+	size = lp->charsoff + lp->charssize;
+	lp->lsisoff = JJL_ALIGN_UP(size, struct lsinfo);
+	lp->size = lp->lsisoff + sp->leapcnt * sizeof *sp->lsis;
+}
+
+/* JJL: Point the arrays of *CSP into BASE as laid out by *LP, and copy
+   those of *SP there.  */
+static void
+jjl_place_arrays(struct state *csp, char *base, struct state const *sp,
+		 struct state_layout const *lp)
+{
+	csp->atsindex = (uint_least16_t *) (base + lp->atsindexoff);
+	csp->ats = (time_t *) (base + lp->atsoff);
+	csp->types = (unsigned char *) (base + lp->typesoff);
+	csp->ttis = (struct ttinfo *) (base + lp->ttisoff);
+	csp->wallatsindex = (uint_least16_t *) (base + lp->wallatsindexoff);
+	csp->wallats = (time_t *) (base + lp->wallatsoff);
+	csp->chars = base + lp->charsoff;
+	csp->lsis = (struct lsinfo *) (base + lp->lsisoff);
+	memcpy(csp->atsindex, sp->atsindex,
+	       sp->indexcnt * sizeof *sp->atsindex);
+	memcpy(csp->ats, sp->ats, sp->timecnt * sizeof *sp->ats);
+	memcpy(csp->types, sp->types, sp->timecnt * sizeof *sp->types);
+	memcpy(csp->ttis, sp->ttis, lp->ttiscnt * sizeof *sp->ttis);
+	memcpy(csp->wallatsindex, sp->wallatsindex,
+	       lp->wallindexcnt * sizeof *sp->wallatsindex);
+	memcpy(csp->wallats, sp->wallats, lp->wallcnt * sizeof *sp->wallats);
+	memcpy(csp->chars, sp->chars, lp->charssize);
+	csp->chars[lp->charssize - 1] = '\0';
+	memcpy(csp->lsis, sp->lsis, sp->leapcnt * sizeof *sp->lsis);
+}
+
+/*
+** JJL: Copy *SP into one allocation with its arrays sized to fit.
+** Return NULL (with errno set) if out of memory.
+*/
+static struct state *
+jjl_compact_state(struct state const *sp)
+{
+	register struct state *	csp;
+	struct state_layout	layout;
+
+	jjl_layout_state(sp, sizeof *sp, &layout);
+	csp = malloc(layout.size);
+	if (!csp)
+		return NULL;
+	*csp = *sp;
+	jjl_place_arrays(csp, (char *) csp, sp, &layout);
+	return csp;
+}
+
+/*
+** JJL: A snapshot is one file of zones compiled by jjl_tzsnapshot_write,
+** which jjl_tzalloc takes zones from instead of loading them once
+** jjl_tzsnapshot_open has mapped it. Each zone is stored as its struct state
+** would be compacted, with offsets from the zone's start in place of
+** pointers, so a zone from the snapshot is just a struct state pointing into
+** the mapping, and the pages are shared by every process that maps it.
+** Snapshots are native-endian and tied to this layout, so they can only be
+** used by a build like the one that wrote them.
+*/
+
+#define JJL_SNAPSHOT_MAGIC	"JJLTZSS"
+#define JJL_SNAPSHOT_VERSION	2
+#define JJL_SNAPSHOT_BYTEORDER	0x01020304
+#define JJL_SNAPSHOT_LAYOUT \
+	((uint_least32_t) sizeof (time_t) << 24 \
+	 | (uint_least32_t) sizeof (struct ttinfo) << 16 \
+	 | (uint_least32_t) sizeof (struct lsinfo) << 8 \
+	 | JJL_INDEX_BUCKET_SHIFT)
+
+struct jjl_snapshot_header {
+	char		magic[8];	/* JJL_SNAPSHOT_MAGIC */
+	uint32_t	version;	/* JJL_SNAPSHOT_VERSION */
+	uint32_t	byteorder;	/* JJL_SNAPSHOT_BYTEORDER */
+	uint32_t	layout;		/* JJL_SNAPSHOT_LAYOUT */
+	uint32_t	zonecnt;
+	uint64_t	size;		/* of the whole file */
+	/* followed by zonecnt struct jjl_snapshot_entry, sorted by name */
+};
+
+struct jjl_snapshot_entry {
+	uint32_t	nameoff;	/* NUL-terminated, from the file start */
+	uint32_t	zoneoff;	/* from the file start */
+};
+
+struct jjl_snapshot_zone {
+	int32_t		leapcnt;
+	int32_t		timecnt;
+	int32_t		typecnt;
+	int32_t		charcnt;
+	int32_t		defaulttype;
+	int32_t		indexcnt;
+	int64_t		indexstart;
+	uint8_t		goback;
+	uint8_t		goahead;
+	uint8_t		haswallats;
+	uint8_t		hasrule;
+	uint8_t		ruletypes[2];
+	struct rule	rulestart;
+	struct rule	ruleend;
+	/* the arrays, as offsets from the zone start */
+	uint32_t	atsindexoff;
+	uint32_t	atsoff;
+	uint32_t	typesoff;
+	uint32_t	ttisoff;
+	uint32_t	wallatsindexoff;
+	uint32_t	wallatsoff;
+	uint32_t	charsoff;
+	uint32_t	lsisoff;
+};
+
+/* Zones in a snapshot start at multiples of this.  */
+#define JJL_SNAPSHOT_ALIGN	16
+
+static char const *	jjl_snapshot;
+
+/* Is SIZE bytes at OFF (of alignment ALIGN) within the mapped snapshot? */
+static bool
+jjl_snapshot_has(uint_fast64_t off, uint_fast64_t size, size_t align,
+		 size_t snapshotsize)
+{
+	return off % align == 0 && off <= snapshotsize
+		&& size <= snapshotsize - off;
+}
+
+/* Is *RP a rule that getrule could have given?  */
+static bool
+jjl_snapshot_rule_ok(struct rule const *rp)
+{
+	int_fast32_t	maxtime = HOURSPERDAY * DAYSPERWEEK * SECSPERHOUR;
+
+	if (! (-maxtime < rp->r_time && rp->r_time < maxtime))
+		return false;
+	switch (rp->r_type) {
+	case JULIAN_DAY:
+		return 1 <= rp->r_day && rp->r_day <= DAYSPERNYEAR;
+	case DAY_OF_YEAR:
+		return 0 <= rp->r_day && rp->r_day <= DAYSPERLYEAR - 1;
+	case MONTH_NTH_DAY_OF_WEEK:
+		return (1 <= rp->r_mon && rp->r_mon <= MONSPERYEAR
+			&& 1 <= rp->r_week && rp->r_week <= 5
+			&& 0 <= rp->r_day && rp->r_day <= DAYSPERWEEK - 1);
+	}
+	return false;
+}
+
+/*
+** Check that the zone at ZONEOFF in the snapshot MAP can be used without
+** reading out of bounds.  Only the writer's bugs or a damaged file would make
+** it fail, but the snapshot shouldn't be trusted any more than a TZif file.
+*/
+static bool
+jjl_snapshot_zone_ok(char const *map, size_t size, uint_fast64_t zoneoff)
+{
+	struct jjl_snapshot_zone const *zp;
+	struct ttinfo const *	ttis;
+	unsigned char const *	types;
+	uint_least16_t const *	index;
+	int			i, ttiscnt, wallcnt, wallindexcnt;
+	uint_fast64_t		charssize;
+
+	if (!jjl_snapshot_has(zoneoff, sizeof *zp, JJL_SNAPSHOT_ALIGN, size))
+		return false;
+	zp = (struct jjl_snapshot_zone const *) (map + zoneoff);
+	if (! (0 <= zp->leapcnt && zp->leapcnt <= TZ_MAX_LEAPS
+	       && 0 <= zp->timecnt && zp->timecnt <= TZ_MAX_TIMES
+	       && 0 <= zp->typecnt && zp->typecnt <= TZ_MAX_TYPES
+	       && 0 <= zp->charcnt && zp->charcnt <= (int) STATE_CHARS_SIZE
+	       && 0 <= zp->indexcnt && zp->indexcnt <= JJL_INDEX_BUCKETS
+	       && zp->haswallats <= 1 && zp->hasrule <= 1))
+		return false;
+	ttiscnt = BIGGEST(zp->typecnt, 1);
+	if (zp->hasrule
+	    && ! (zp->ruletypes[0] < ttiscnt && zp->ruletypes[1] < ttiscnt
+		  && jjl_snapshot_rule_ok(&zp->rulestart)
+		  && jjl_snapshot_rule_ok(&zp->ruleend)))
+		return false;
+	wallcnt = zp->haswallats ? zp->timecnt : 0;
+	wallindexcnt = zp->haswallats ? zp->indexcnt : 0;
+	charssize = BIGGEST(SMALLEST(zp->charcnt + 1, (int) STATE_CHARS_SIZE),
+			    (int) sizeof gmt);
+	if (! (0 <= zp->defaulttype && zp->defaulttype < ttiscnt
+	       && jjl_snapshot_has(zoneoff + zp->atsindexoff,
+				   zp->indexcnt * sizeof (uint_least16_t),
+				   _Alignof (uint_least16_t), size)
+	       && jjl_snapshot_has(zoneoff + zp->atsoff,
+				   zp->timecnt * sizeof (time_t),
+				   _Alignof (time_t), size)
+	       && jjl_snapshot_has(zoneoff + zp->typesoff, zp->timecnt, 1, size)
+	       && jjl_snapshot_has(zoneoff + zp->ttisoff,
+				   ttiscnt * sizeof (struct ttinfo),
+				   _Alignof (struct ttinfo), size)
+	       && jjl_snapshot_has(zoneoff + zp->wallatsindexoff,
+				   wallindexcnt * sizeof (uint_least16_t),
+				   _Alignof (uint_least16_t), size)
+	       && jjl_snapshot_has(zoneoff + zp->wallatsoff,
+				   wallcnt * sizeof (time_t),
+				   _Alignof (time_t), size)
+	       && jjl_snapshot_has(zoneoff + zp->charsoff, charssize, 1, size)
+	       && jjl_snapshot_has(zoneoff + zp->lsisoff,
+				   zp->leapcnt * sizeof (struct lsinfo),
+				   _Alignof (struct lsinfo), size)))
+		return false;
+	types = (unsigned char const *) (map + zoneoff + zp->typesoff);
+	for (i = 0; i < zp->timecnt; ++i)
+		if (ttiscnt <= types[i])
+			return false;
+	ttis = (struct ttinfo const *) (map + zoneoff + zp->ttisoff);
+	for (i = 0; i < ttiscnt; ++i)
+		if (! (0 <= ttis[i].tt_abbrind
+		       && ttis[i].tt_abbrind < (int) charssize))
+			return false;
+	if (map[zoneoff + zp->charsoff + charssize - 1] != '\0')
+		return false;
+	index = (uint_least16_t const *) (map + zoneoff + zp->atsindexoff);
+	for (i = 0; i < zp->indexcnt; ++i)
+		if (zp->timecnt < index[i])
+			return false;
+	index = (uint_least16_t const *) (map + zoneoff + zp->wallatsindexoff);
+	for (i = 0; i < wallindexcnt; ++i)
+		if (zp->timecnt < index[i])
+			return false;
+	return true;
+}
+
+static bool
+jjl_snapshot_ok(char const *map, size_t size)
+{
+	struct jjl_snapshot_header const *hp =
+		(struct jjl_snapshot_header const *) map;
+	struct jjl_snapshot_entry const *entries =
+		(struct jjl_snapshot_entry const *) (hp + 1);
+	uint_fast64_t		i;
+
+	if (size < sizeof *hp
+	    || memcmp(hp->magic, JJL_SNAPSHOT_MAGIC, sizeof hp->magic) != 0
+	    || hp->version != JJL_SNAPSHOT_VERSION
+	    || hp->byteorder != JJL_SNAPSHOT_BYTEORDER
+	    || hp->layout != JJL_SNAPSHOT_LAYOUT
+	    || hp->size != size
+	    || !jjl_snapshot_has(sizeof *hp,
+				 (uint_fast64_t) hp->zonecnt * sizeof *entries,
+				 _Alignof (struct jjl_snapshot_entry), size))
+		return false;
+	for (i = 0; i < hp->zonecnt; ++i) {
+		uint_fast64_t nameoff = entries[i].nameoff;
+
+		if (size <= nameoff
+		    || !memchr(map + nameoff, '\0', size - nameoff)
+		    || (i > 0 && strcmp(map + entries[i - 1].nameoff,
+					map + nameoff) >= 0)
+		    || !jjl_snapshot_zone_ok(map, size, entries[i].zoneoff))
+			return false;
+	}
+	return true;
+}
+
+bool
+jjl_tzsnapshot_open(char const *path)
+{
+	register int	fid;
+	register int	err;
+	struct stat	st;
+	size_t		size;
+	void *		map;
+
+	fid = JJLSafeOpen(path, OPEN_MODE);
+	if (fid < 0)
+		return false;
+	if (fstat(fid, &st) != 0) {
+		err = errno;
+		close(fid);
+		errno = err;
+		return false;
+	}
+	if (st.st_size < (off_t) sizeof (struct jjl_snapshot_header)
+	    || SIZE_MAX < (uintmax_t) st.st_size) {
+		close(fid);
+		errno = EINVAL;
+		return false;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fid, 0);
+	err = errno;
+	close(fid);
+	if (map == MAP_FAILED) {
+		errno = err;
+		return false;
+	}
+	if (!jjl_snapshot_ok(map, size)) {
+		munmap(map, size);
+		errno = EINVAL;
+		return false;
+	}
+	/* Zones from an earlier snapshot may still point into it, so it
+	   stays mapped.  */
+	jjl_snapshot = map;
+	return true;
+}
+
+/* The zone named NAME in the mapped snapshot, or NULL if there isn't one.  */
+static struct jjl_snapshot_zone const *
+jjl_snapshot_find(char const *name)
+{
+	struct jjl_snapshot_header const *hp =
+		(struct jjl_snapshot_header const *) jjl_snapshot;
+	struct jjl_snapshot_entry const *entries =
+		(struct jjl_snapshot_entry const *) (hp + 1);
+	register int_fast64_t	lo = 0;
+	register int_fast64_t	hi = hp->zonecnt;
+
+	while (lo < hi) {
+		register int_fast64_t	mid = (lo + hi) >> 1;
+		register int		cmp =
+			strcmp(name, jjl_snapshot + entries[mid].nameoff);
+
+		if (cmp == 0)
+			return (struct jjl_snapshot_zone const *)
+				(jjl_snapshot + entries[mid].zoneoff);
+		if (cmp < 0)
+			hi = mid;
+		else	lo = mid + 1;
+	}
+	return NULL;
+}
+
+/* A state for the snapshot zone *ZP, whose arrays stay in the snapshot.  */
+static struct state *
+jjl_snapshot_state(struct jjl_snapshot_zone const *zp)
+{
+	register struct state *	sp = malloc(sizeof *sp);
+	register char *		base = (char *) zp;
+
+	if (!sp)
+		return NULL;
+	sp->leapcnt = zp->leapcnt;
+	sp->timecnt = zp->timecnt;
+	sp->typecnt = zp->typecnt;
+	sp->charcnt = zp->charcnt;
+	sp->goback = zp->goback;
+	sp->goahead = zp->goahead;
+	sp->defaulttype = zp->defaulttype;
+	sp->haswallats = zp->haswallats;
+	sp->indexcnt = zp->indexcnt;
+	sp->indexstart = zp->indexstart;
+	sp->hasrule = false;
+	if (zp->hasrule)
+		jjl_set_rule(sp, &zp->rulestart, &zp->ruleend,
+			     zp->ruletypes[0], zp->ruletypes[1]);
+	sp->atsindex = (uint_least16_t *) (base + zp->atsindexoff);
+	sp->ats = (time_t *) (base + zp->atsoff);
+	sp->types = (unsigned char *) (base + zp->typesoff);
+	sp->ttis = (struct ttinfo *) (base + zp->ttisoff);
+	sp->wallatsindex = (uint_least16_t *) (base + zp->wallatsindexoff);
+	sp->wallats = (time_t *) (base + zp->wallatsoff);
+	sp->chars = base + zp->charsoff;
+	sp->lsis = (struct lsinfo *) (base + zp->lsisoff);
+	return sp;
+}
+
+static int
+jjl_compare_names(void const *a, void const *b)
+{
+	return strcmp(*(char const *const *) a, *(char const *const *) b);
+}
+
+/* JJL: Copy the COUNT NAMES to SORTED in order, leaving out duplicates and
+   empty names, and return how many there are.  */
+static int
+jjl_sort_names(char const **sorted, char const *const *names, int count)
+{
+	register int	i, sortedcnt = 0;
+
+	if (count)
+		memcpy(sorted, names, count * sizeof *sorted);
+	qsort(sorted, count, sizeof *sorted, jjl_compare_names);
+	for (i = 0; i < count; ++i)
+		if (sorted[i][0] && (sortedcnt == 0
+		    || strcmp(sorted[sortedcnt - 1], sorted[i]) != 0))
+			sorted[sortedcnt++] = sorted[i];
+	return sortedcnt;
+}
+
+/* Grow the zeroed buffer *BUFP, of *CAPP bytes, to at least SIZE bytes.  */
+static bool
+jjl_grow(char **bufp, size_t *capp, size_t size)
+{
+	size_t	cap = *capp ? *capp : 1 << 16;
+	char *	buf;
+
+	if (size <= *capp)
+		return true;
+	while (cap < size)
+		cap *= 2;
+	buf = realloc(*bufp, cap);
+	if (!buf)
+		return false;
+	memset(buf + *capp, 0, cap - *capp);
+	*bufp = buf;
+	*capp = cap;
+	return true;
+}
+
+int
+jjl_tzsnapshot_write(char const *path, char const *const *names, int count)
+{
+	struct full_state *	fsp = malloc(sizeof *fsp);
+	char const **		sorted = malloc((count + 1) * sizeof *sorted);
+	struct jjl_snapshot_header *hp;
+	struct jjl_snapshot_entry *entries;
+	char *			buf = NULL;
+	size_t			cap = 0;
+	size_t			nameoff, zoneoff, size;
+	char *			tmppath = NULL;
+	int			i, zonecnt = 0, fid = -1, err = 0;
+
+	if (!fsp || !sorted || count < 0) {
+		err = count < 0 ? EINVAL : errno;
+		goto done;
+	}
+	count = jjl_sort_names(sorted, names, count);
+
+	/* The header and entries, then the names, then the zones.  */
+	nameoff = sizeof *hp + count * sizeof *entries;
+	for (i = 0; i < count; ++i)
+		nameoff += strlen(sorted[i]) + 1;
+	zoneoff = nameoff;
+	nameoff = sizeof *hp + count * sizeof *entries;
+	if (!jjl_grow(&buf, &cap, zoneoff)) {
+		err = errno;
+		goto done;
+	}
+	for (i = 0; i < count; ++i) {
+		struct state_layout	layout;
+		struct jjl_snapshot_zone *zp;
+		struct state		placed;
+
+		if (zoneinit(full_state_init(fsp), sorted[i]) != 0)
+			continue;
+		jjl_layout_state(&fsp->st, sizeof *zp, &layout);
+		zoneoff = (zoneoff + JJL_SNAPSHOT_ALIGN - 1)
+			& ~(size_t) (JJL_SNAPSHOT_ALIGN - 1);
+		if (UINT32_MAX < zoneoff + layout.size) {
+			err = EFBIG;
+			goto done;
+		}
+		if (!jjl_grow(&buf, &cap, zoneoff + layout.size)) {
+			err = errno;
+			goto done;
+		}
+		zp = (struct jjl_snapshot_zone *) (buf + zoneoff);
+		jjl_place_arrays(&placed, (char *) zp, &fsp->st, &layout);
+		zp->leapcnt = fsp->st.leapcnt;
+		zp->timecnt = fsp->st.timecnt;
+		zp->typecnt = fsp->st.typecnt;
+		zp->charcnt = fsp->st.charcnt;
+		zp->defaulttype = fsp->st.defaulttype;
+		zp->indexcnt = fsp->st.indexcnt;
+		zp->indexstart = fsp->st.indexstart;
+		zp->goback = fsp->st.goback;
+		zp->goahead = fsp->st.goahead;
+		zp->haswallats = fsp->st.haswallats;
+		zp->hasrule = fsp->st.hasrule;
+		if (fsp->st.hasrule) {
+			zp->ruletypes[0] = fsp->st.ruletypes[0];
+			zp->ruletypes[1] = fsp->st.ruletypes[1];
+			zp->rulestart = fsp->st.rulestart;
+			zp->ruleend = fsp->st.ruleend;
+		}
+		zp->atsindexoff = layout.atsindexoff;
+		zp->atsoff = layout.atsoff;
+		zp->typesoff = layout.typesoff;
+		zp->ttisoff = layout.ttisoff;
+		zp->wallatsindexoff = layout.wallatsindexoff;
+		zp->wallatsoff = layout.wallatsoff;
+		zp->charsoff = layout.charsoff;
+		zp->lsisoff = layout.lsisoff;
+		entries = (struct jjl_snapshot_entry *) (buf + sizeof *hp);
+		entries[zonecnt].nameoff = nameoff;
+		entries[zonecnt].zoneoff = zoneoff;
+		strcpy(buf + nameoff, sorted[i]);
+		nameoff += strlen(sorted[i]) + 1;
+		zoneoff += layout.size;
+		++zonecnt;
+	}
+	size = zoneoff;
+	hp = (struct jjl_snapshot_header *) buf;
+	memcpy(hp->magic, JJL_SNAPSHOT_MAGIC, sizeof hp->magic);
+	hp->version = JJL_SNAPSHOT_VERSION;
+	hp->byteorder = JJL_SNAPSHOT_BYTEORDER;
+	hp->layout = JJL_SNAPSHOT_LAYOUT;
+	hp->zonecnt = zonecnt;
+	hp->size = size;
+
+	/* Write to a temporary file and rename it into place, so that a process
+	   opening the snapshot meanwhile gets either the old one or the new.  */
+	tmppath = malloc(strlen(path) + sizeof ".tmp");
+	if (!tmppath) {
+		err = errno;
+		goto done;
+	}
+	strcpy(tmppath, path);
+	strcat(tmppath, ".tmp");
+	fid = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fid < 0) {
+		err = errno;
+		goto done;
+	}
+	for (zoneoff = 0; zoneoff < size; ) {
+		ssize_t written = write(fid, buf + zoneoff, size - zoneoff);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			goto done;
+		}
+		zoneoff += written;
+	}
+	if (close(fid) != 0) {
+		fid = -1;
+		err = errno;
+		goto done;
+	}
+	fid = -1;
+	if (rename(tmppath, path) != 0)
+		err = errno;
+done:
+	if (0 <= fid)
+		close(fid);
+	if (err != 0 && tmppath)
+		unlink(tmppath);
+	free(tmppath);
+	free(buf);
+	free(sorted);
+	free(fsp);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return zonecnt;
+}
+
+/*
+** JJL: Zones can also be compiled into the library, for startup without any
+** file system access (e.g. in containers without zoneinfo). jjl_tzembed_write
+** writes them as static const tables, again laid out as compacted states, to
+** a header that's included when building with JJL_TZ_EMBEDDED. Embedded
+** zones are found before those of a snapshot or the file system, and aren't
+** allocated or freed.
+*/
+
+static void
+jjl_embed_times(FILE *fp, char const *what, int zone, time_t const *times,
+		int count)
+{
+	register int	i;
+
+	if (count == 0)
+		return;
+	fprintf(fp, "static time_t const jjl_embedded_%s_%d[] = {", what, zone);
+	for (i = 0; i < count; ++i) {
+		fputs(i % 4 ? " " : "\n\t", fp);
+		if (times[i] == TIME_T_MIN)
+			fputs("TIME_T_MIN,", fp);
+		else	fprintf(fp, "%jd,", (intmax_t) times[i]);
+	}
+	fputs("\n};\n", fp);
+}
+
+static void
+jjl_embed_index(FILE *fp, char const *what, int zone,
+		uint_least16_t const *index, int count)
+{
+	register int	i;
+
+	if (count == 0)
+		return;
+	fprintf(fp, "static uint_least16_t const jjl_embedded_%s_%d[] = {",
+		what, zone);
+	for (i = 0; i < count; ++i)
+		fprintf(fp, "%s%d,", i % 12 ? " " : "\n\t", (int) index[i]);
+	fputs("\n};\n", fp);
+}
+
+/* Write the arrays of zone number ZONE, *SP, as static const tables.  */
+static void
+jjl_embed_arrays(FILE *fp, int zone, struct state const *sp)
+{
+	struct state_layout	layout;
+	register int		i;
+
+	jjl_layout_state(sp, 0, &layout);
+	jjl_embed_index(fp, "atsindex", zone, sp->atsindex, sp->indexcnt);
+	jjl_embed_times(fp, "ats", zone, sp->ats, sp->timecnt);
+	if (sp->timecnt) {
+		fprintf(fp, "static unsigned char const jjl_embedded_types_%d[] = {",
+			zone);
+		for (i = 0; i < sp->timecnt; ++i)
+			fprintf(fp, "%s%d,", i % 16 ? " " : "\n\t",
+				sp->types[i]);
+		fputs("\n};\n", fp);
+	}
+	fprintf(fp, "static struct ttinfo const jjl_embedded_ttis_%d[] = {\n",
+		zone);
+	for (i = 0; i < layout.ttiscnt; ++i)
+		fprintf(fp, "\t{ %ld, %d, %d, %d, %d },\n",
+			(long) sp->ttis[i].tt_gmtoff, sp->ttis[i].tt_isdst,
+			sp->ttis[i].tt_abbrind, sp->ttis[i].tt_ttisstd,
+			sp->ttis[i].tt_ttisgmt);
+	fputs("};\n", fp);
+	jjl_embed_index(fp, "wallatsindex", zone, sp->wallatsindex,
+			layout.wallindexcnt);
+	jjl_embed_times(fp, "wallats", zone, sp->wallats, layout.wallcnt);
+	/* Octal escapes are always three digits, so a digit can follow.  */
+	fprintf(fp, "static char const jjl_embedded_chars_%d[%d] = \"",
+		zone, (int) layout.charssize);
+	for (i = 0; i < (int) layout.charssize - 1; ++i)
+		if (strchr(TZ_ABBR_CHAR_SET, sp->chars[i]) && sp->chars[i]
+		    && sp->chars[i] != '"' && sp->chars[i] != '\\')
+			fputc(sp->chars[i], fp);
+		else	fprintf(fp, "\\%03o", (unsigned char) sp->chars[i]);
+	fputs("\";\n", fp);
+	if (sp->leapcnt) {
+		fprintf(fp, "static struct lsinfo const jjl_embedded_lsis_%d[] = {\n",
+			zone);
+		for (i = 0; i < sp->leapcnt; ++i)
+			fprintf(fp, "\t{ %jd, %jd },\n",
+				(intmax_t) sp->lsis[i].ls_trans,
+				(intmax_t) sp->lsis[i].ls_corr);
+		fputs("};\n", fp);
+	}
+	fputc('\n', fp);
+}
+
+static void
+jjl_embed_pointer(FILE *fp, char const *field, char const *type,
+		  char const *what, int zone, bool present)
+{
+	if (present)
+		fprintf(fp, "\t\t.%s = (%s *) jjl_embedded_%s_%d,\n",
+			field, type, what, zone);
+}
+
+int
+jjl_tzembed_write(char const *path, char const *const *names, int count)
+{
+	struct full_state *	fsp = malloc(sizeof *fsp);
+	char const **		sorted = malloc((count + 1) * sizeof *sorted);
+	struct state *		states = malloc((count + 1) * sizeof *states);
+	FILE *			fp = NULL;
+	int			i, zonecnt = 0, err = 0;
+
+	if (!fsp || !sorted || !states || count < 0) {
+		err = count < 0 ? EINVAL : errno;
+		goto done;
+	}
+	count = jjl_sort_names(sorted, names, count);
+	fp = fopen(path, "w");
+	if (!fp) {
+		err = errno;
+		goto done;
+	}
+	fputs("/* Zones for JJL_TZ_EMBEDDED, written by jjl_tzembed_write."
+	      "  Don't edit.  */\n\n", fp);
+	for (i = 0; i < count; ++i) {
+		if (zoneinit(full_state_init(fsp), sorted[i]) != 0)
+			continue;
+		jjl_embed_arrays(fp, zonecnt, &fsp->st);
+		states[zonecnt] = fsp->st;
+		sorted[zonecnt++] = sorted[i];
+	}
+	if (zonecnt == 0) {
+		err = ENOENT;
+		goto done;
+	}
+	/* Not const, since lookups fill each state's rule cache.  */
+	fputs("static struct state jjl_embedded_states[] = {\n", fp);
+	for (i = 0; i < zonecnt; ++i) {
+		struct state const *sp = &states[i];
+
+		fprintf(fp, "\t{\n\t\t.leapcnt = %d,\n\t\t.timecnt = %d,\n"
+			"\t\t.typecnt = %d,\n\t\t.charcnt = %d,\n"
+			"\t\t.goback = %d,\n\t\t.goahead = %d,\n"
+			"\t\t.defaulttype = %d,\n\t\t.haswallats = %d,\n"
+			"\t\t.indexcnt = %d,\n\t\t.indexstart = %jd,\n",
+			sp->leapcnt, sp->timecnt, sp->typecnt, sp->charcnt,
+			sp->goback, sp->goahead, sp->defaulttype,
+			sp->haswallats, sp->indexcnt, (intmax_t) sp->indexstart);
+		if (sp->hasrule)
+			fprintf(fp, "\t\t.hasrule = 1,\n"
+				"\t\t.ruletypes = { %d, %d },\n"
+				"\t\t.rulestart = { %d, %d, %d, %d, %ld },\n"
+				"\t\t.ruleend = { %d, %d, %d, %d, %ld },\n",
+				sp->ruletypes[0], sp->ruletypes[1],
+				sp->rulestart.r_type, sp->rulestart.r_day,
+				sp->rulestart.r_week, sp->rulestart.r_mon,
+				(long) sp->rulestart.r_time,
+				sp->ruleend.r_type, sp->ruleend.r_day,
+				sp->ruleend.r_week, sp->ruleend.r_mon,
+				(long) sp->ruleend.r_time);
+		jjl_embed_pointer(fp, "atsindex", "uint_least16_t", "atsindex",
+				  i, sp->indexcnt);
+		jjl_embed_pointer(fp, "ats", "time_t", "ats", i, sp->timecnt);
+		jjl_embed_pointer(fp, "types", "unsigned char", "types", i,
+				  sp->timecnt);
+		jjl_embed_pointer(fp, "ttis", "struct ttinfo", "ttis", i, true);
+		jjl_embed_pointer(fp, "wallatsindex", "uint_least16_t",
+				  "wallatsindex", i,
+				  sp->haswallats && sp->indexcnt);
+		jjl_embed_pointer(fp, "wallats", "time_t", "wallats", i,
+				  sp->haswallats && sp->timecnt);
+		jjl_embed_pointer(fp, "chars", "char", "chars", i, true);
+		jjl_embed_pointer(fp, "lsis", "struct lsinfo", "lsis", i,
+				  sp->leapcnt);
+		fputs("\t},\n", fp);
+	}
+	fputs("};\n\nstatic char const *const jjl_embedded_names[] = {\n", fp);
+	for (i = 0; i < zonecnt; ++i)
+		fprintf(fp, "\t\"%s\",\n", sorted[i]);
+	fputs("};\n", fp);
+done:
+	if (fp) {
+		if (ferror(fp) && err == 0)
+			err = EIO;
+		if (fclose(fp) != 0 && err == 0)
+			err = errno;
+		if (err != 0)
+			unlink(path);
+	}
+	free(states);
+	free(sorted);
+	free(fsp);
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return zonecnt;
+}
+
+#ifdef JJL_TZ_EMBEDDED
+#include "tzembedded.h"
+
+#define JJL_EMBEDDED_COUNT \
+	((int) (sizeof jjl_embedded_states / sizeof *jjl_embedded_states))
+
+/* The embedded zone named NAME, or NULL if there isn't one.  */
+static struct state *
+jjl_embedded_find(char const *name)
+{
+	register int	lo = 0;
+	register int	hi = JJL_EMBEDDED_COUNT;
+
+	while (lo < hi) {
+		register int	mid = (lo + hi) >> 1;
+		register int	cmp = strcmp(name, jjl_embedded_names[mid]);
+
+		if (cmp == 0)
+			return &jjl_embedded_states[mid];
+		if (cmp < 0)
+			hi = mid;
+		else	lo = mid + 1;
+	}
+	return NULL;
+}
+#endif /* defined JJL_TZ_EMBEDDED */
+
 timezone_t
 jjl_tzalloc(char const *name)
 {
-  timezone_t sp = malloc(sizeof *sp);
-  if (sp) {
-    int err = zoneinit(sp, name);
-    if (err != 0) {
-      free(sp);
+  struct full_state *fsp;
+  timezone_t sp = NULL;
+#ifdef JJL_TZ_EMBEDDED
+  if (name && name[0]) {
+    struct state *esp = jjl_embedded_find(name[0] == ':' ? name + 1 : name);
+    if (esp)
+      return esp;
+  }
+#endif /* defined JJL_TZ_EMBEDDED */
+  if (jjl_snapshot && name && name[0]) {
+    struct jjl_snapshot_zone const *zp =
+      jjl_snapshot_find(name[0] == ':' ? name + 1 : name);
+    if (zp)
+      return jjl_snapshot_state(zp);
+  }
+  fsp = malloc(sizeof *fsp);
+  if (fsp) {
+    int err = zoneinit(full_state_init(fsp), name);
+    if (err == 0) {
+      sp = jjl_compact_state(&fsp->st);
+      err = sp ? 0 : errno;
+    }
+    free(fsp);
+    if (err != 0)
       errno = err;
+  }
+  return sp;
+}
+
+/*
+** JJL: Allocate a zone from a POSIX TZ string alone, e.g.
+** "EST5EDT,M3.2.0,M11.1.0", unlike jjl_tzalloc, which looks for a file of
+** that name first. The zone keeps the string's rule instead of its
+** transitions; see jjl_set_rule.
+*/
+timezone_t
+jjl_tzalloc_posix(char const *tz)
+{
+  struct full_state *fsp;
+  struct state *sp;
+  timezone_t csp = NULL;
+  int err = 0;
+
+  if (!tz || !tz[0] || tz[0] == ':') {
+    errno = EINVAL;
+    return NULL;
+  }
+  fsp = malloc(sizeof *fsp);
+  if (!fsp)
+    return NULL;
+  sp = full_state_init(fsp);
+  if (tzparse(tz, sp, false, NULL)) {
+    scrub_abbrs(sp);
+    jjl_set_wallats(sp);
+    jjl_set_indexes(sp);
+    csp = jjl_compact_state(sp);
+    err = csp ? 0 : errno;
+  } else
+    err = EINVAL;
+  free(fsp);
+  if (err != 0)
+    errno = err;
+  return csp;
+}
+
+/* JJL: Write to ABBR a numeric abbreviation for UTOFF like zic gives zones
+   without names, e.g. "+0530", or "GMT" for UT itself.  */
+static void
+jjl_numeric_abbr(char *abbr, long utoff)
+{
+  long a = utoff < 0 ? -utoff : utoff;
+  char sign = utoff < 0 ? '-' : '+';
+
+  if (utoff == 0)
+    strcpy(abbr, gmt);
+  else if (a % SECSPERMIN != 0)
+    sprintf(abbr, "%c%02ld%02ld%02ld", sign, a / SECSPERHOUR,
+	    a / SECSPERMIN % MINSPERHOUR, a % SECSPERMIN);
+  else if (a % SECSPERHOUR != 0)
+    sprintf(abbr, "%c%02ld%02ld", sign, a / SECSPERHOUR,
+	    a / SECSPERMIN % MINSPERHOUR);
+  else
+    sprintf(abbr, "%c%02ld", sign, a / SECSPERHOUR);
+}
+
+/*
+** JJL: Allocate a zone that is always UTOFF seconds east of UT. It has no
+** transitions, so localsub and mktime_tzname need no lookup or search for it,
+** and it gets a numeric abbreviation like zic gives such zones, e.g. "+0530".
+*/
+timezone_t
+jjl_tzalloc_fixed(long utoff)
+{
+  struct full_state *fsp;
+  struct state *sp;
+  timezone_t csp;
+  int err;
+
+  if (! (-SECSPERDAY < utoff && utoff < SECSPERDAY)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  fsp = malloc(sizeof *fsp);
+  if (!fsp)
+    return NULL;
+  sp = full_state_init(fsp);
+  sp->leapcnt = 0;
+  sp->timecnt = 0;
+  sp->typecnt = 1;
+  sp->goback = sp->goahead = false;
+  sp->hasrule = false;
+  init_ttinfo(&sp->ttis[0], utoff, false, 0);
+  jjl_numeric_abbr(sp->chars, utoff);
+  sp->charcnt = strlen(sp->chars) + 1;
+  sp->defaulttype = 0;
+  jjl_set_wallats(sp);
+  jjl_set_indexes(sp);
+  csp = jjl_compact_state(sp);
+  err = csp ? 0 : errno;
+  free(fsp);
+  if (err != 0)
+    errno = err;
+  return csp;
+}
+
+/* JJL: The type in SP for UTOFF and ISDST, which is added with a numeric
+   abbreviation if SP doesn't have it yet, or -1 if there's no room.  */
+static int
+jjl_type_for(struct state *sp, long utoff, bool isdst)
+{
+  char abbr[sizeof "+hhmmss"];
+  int i, j;
+
+  for (i = 0; i < sp->typecnt; i++)
+    if (sp->ttis[i].tt_gmtoff == utoff && sp->ttis[i].tt_isdst == isdst)
+      return i;
+  if (! (sp->typecnt < TZ_MAX_TYPES))
+    return -1;
+  jjl_numeric_abbr(abbr, utoff);
+  for (j = 0; j < sp->charcnt; j += strlen(sp->chars + j) + 1)
+    if (strcmp(sp->chars + j, abbr) == 0)
+      break;
+  if (j == sp->charcnt) {
+    if (STATE_CHARS_SIZE < sp->charcnt + strlen(abbr) + 1)
+      return -1;
+    strcpy(sp->chars + j, abbr);
+    sp->charcnt += strlen(abbr) + 1;
+  }
+  init_ttinfo(&sp->ttis[sp->typecnt], utoff, isdst, j);
+  return sp->typecnt++;
+}
+
+/* JJL: Have SP follow the POSIX TZ string RULE after its last transition,
+   like tzloadbody does with a TZif file's footer.  */
+static int
+jjl_extend_with_rule(struct state *sp, char const *rule)
+{
+  struct full_state *fsp = malloc(sizeof *fsp);
+  struct state *ts;
+  int types[2];
+  int i;
+
+  if (!fsp)
+    return errno;
+  ts = full_state_init(fsp);
+  if (! (tzparse(rule, ts, false, sp) && ts->hasrule)) {
+    free(fsp);
+    return EINVAL;
+  }
+  for (i = 0; i < 2; i++) {
+    types[i] = jjl_type_for(sp, ts->ttis[i].tt_gmtoff, ts->ttis[i].tt_isdst);
+    if (types[i] < 0) {
+      free(fsp);
+      return EINVAL;
+    }
+  }
+  jjl_set_rule(sp, &ts->rulestart, &ts->ruleend, types[ts->ruletypes[0]],
+	       types[ts->ruletypes[1]]);
+  free(fsp);
+  return 0;
+}
+
+/*
+** JJL: Allocate a zone from its history, for zones that the caller knows but
+** the files don't, e.g. ones that the system's own time zone API has under
+** another name. See tzdb.h.
+*/
+timezone_t
+jjl_tzalloc_transitions(long initialutoff, bool initialisdst,
+			time_t const *ats, long const *utoffs,
+			bool const *isdsts, int count, char const *rule)
+{
+  struct full_state *fsp;
+  struct state *sp;
+  timezone_t csp = NULL;
+  int err = 0;
+  int i;
+
+  if (! (0 <= count && count <= TZ_MAX_TIMES
+	 && -SECSPERDAY < initialutoff && initialutoff < SECSPERDAY)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for (i = 0; i < count; i++)
+    if (! (-SECSPERDAY < utoffs[i] && utoffs[i] < SECSPERDAY
+	   && (i == 0 || ats[i - 1] < ats[i]))) {
+      errno = EINVAL;
       return NULL;
     }
+  fsp = malloc(sizeof *fsp);
+  if (!fsp)
+    return NULL;
+  sp = full_state_init(fsp);
+  sp->leapcnt = 0;
+  sp->timecnt = 0;
+  sp->typecnt = 0;
+  sp->charcnt = 0;
+  sp->goback = sp->goahead = false;
+  sp->hasrule = false;
+  /* The initial type is type 0, which is what's used before the first
+     transition.  */
+  sp->defaulttype = jjl_type_for(sp, initialutoff, initialisdst);
+  for (i = 0; i < count && err == 0; i++) {
+    int type = jjl_type_for(sp, utoffs[i], isdsts[i]);
+    int prevtype = sp->timecnt ? sp->types[sp->timecnt - 1] : sp->defaulttype;
+
+    if (type < 0)
+      err = EINVAL;
+    else if (type != prevtype) {
+      sp->ats[sp->timecnt] = ats[i];
+      sp->types[sp->timecnt++] = type;
+    }
   }
-  return sp;
+  if (err == 0 && rule)
+    err = jjl_extend_with_rule(sp, rule);
+  if (err == 0) {
+    jjl_set_wallats(sp);
+    jjl_set_indexes(sp);
+    csp = jjl_compact_state(sp);
+    err = csp ? 0 : errno;
+  }
+  free(fsp);
+  if (err != 0)
+    errno = err;
+  return csp;
+}
+
+/* JJL: Append to BUF (with SIZE bytes left) a quoted name and POSIX offset
+   for the type UTOFF, e.g. "<+0530>-5:30:00", and return its length.  */
+static int
+jjl_rule_type(char *buf, size_t size, long utoff)
+{
+  char abbr[sizeof "+hhmmss"];
+  long a = utoff < 0 ? -utoff : utoff;
+
+  jjl_numeric_abbr(abbr, utoff);
+  return snprintf(buf, size, "<%s>%s%ld:%02ld:%02ld", abbr,
+		  0 < utoff ? "-" : "", a / SECSPERHOUR,
+		  a / SECSPERMIN % MINSPERHOUR, a % SECSPERMIN);
+}
+
+/* JJL: The week of TM's month that TM is in, as a POSIX rule has it, i.e.
+   from 1 to 4, or 5 for the last.  */
+static int
+jjl_rule_week(struct tm const *tm)
+{
+  return (mon_lengths[isleap(tm->tm_year + TM_YEAR_BASE)][tm->tm_mon]
+	  < tm->tm_mday + DAYSPERWEEK
+	  ? 5 : (tm->tm_mday - 1) / DAYSPERWEEK + 1);
+}
+
+/* JJL: Append to BUF (with SIZE bytes left) the POSIX rule for a transition
+   at wall clock time LOCAL, e.g. ",M3.2.0/2:00:00" for 2 AM on the second
+   Sunday of March, and return its length. A day from the 22nd to the 28th
+   can be either the fourth or the last of its weekday, so if PREVLOCAL, the
+   same transition a year before, isn't 0, it decides.  */
+static int
+jjl_rule_date(char *buf, size_t size, time_t local, time_t prevlocal)
+{
+  struct tm tm, prevtm;
+  int week;
+
+  if (!timesub(&local, 0, NULL, &tm))
+    return -1;
+  week = jjl_rule_week(&tm);
+  if (week == 5 && tm.tm_mday <= 4 * DAYSPERWEEK && prevlocal
+      && timesub(&prevlocal, 0, NULL, &prevtm)
+      && prevtm.tm_mon == tm.tm_mon && jjl_rule_week(&prevtm) != 5)
+    week = 4;
+  return snprintf(buf, size, ",M%d.%d.%d/%d:%02d:%02d", tm.tm_mon + 1, week,
+		  tm.tm_wday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/* JJL: The wall clock time of the transition two before AT, which is AT's a
+   year before if the zone has followed the same rule, or 0 if there isn't one
+   like it.  BEFORE is the transition before AT.  */
+static time_t
+jjl_prev_rule_time(time_t const *ats, long const *utoffs, bool const *isdsts,
+		   int at, int before)
+{
+  int prev = at - 2;
+
+  if (prev < 1 || isdsts[prev] != isdsts[at] || utoffs[prev] != utoffs[at]
+      || utoffs[prev - 1] != utoffs[before])
+    return 0;
+  return ats[prev] + utoffs[prev - 1];
+}
+
+bool
+jjl_tzrule_infer(char *buf, size_t size, time_t const *ats,
+		 long const *utoffs, bool const *isdsts, int count)
+{
+  int dst, std, n;
+  size_t len = 0;
+
+  if (count < 2 || isdsts[count - 1] == isdsts[count - 2]
+      || DAYSPERNYEAR * SECSPERDAY < ats[count - 1] - ats[count - 2])
+    return false;
+  dst = isdsts[count - 1] ? count - 1 : count - 2;
+  std = isdsts[count - 1] ? count - 2 : count - 1;
+  /* Each rule's time is in the wall clock time before it, so the change to
+     DST is in standard time and the change back is in DST.  */
+  n = jjl_rule_type(buf, size, utoffs[std]);
+  if (n < 0 || size <= (len += n))
+    return false;
+  n = jjl_rule_type(buf + len, size - len, utoffs[dst]);
+  if (n < 0 || size <= (len += n))
+    return false;
+  n = jjl_rule_date(buf + len, size - len, ats[dst] + utoffs[std],
+		    jjl_prev_rule_time(ats, utoffs, isdsts, dst, std));
+  if (n < 0 || size <= (len += n))
+    return false;
+  n = jjl_rule_date(buf + len, size - len, ats[std] + utoffs[dst],
+		    jjl_prev_rule_time(ats, utoffs, isdsts, std, dst));
+  return 0 <= n && len + n < size;
 }
 
 void
 jjl_tzfree(timezone_t sp)
 {
+#ifdef JJL_TZ_EMBEDDED
+  if ((uintptr_t) jjl_embedded_states <= (uintptr_t) sp
+      && ((uintptr_t) sp
+	  < (uintptr_t) (jjl_embedded_states + JJL_EMBEDDED_COUNT)))
+    return;
+#endif /* defined JJL_TZ_EMBEDDED */
   free(sp);
 }
 
@@ -1476,24 +2861,228 @@ jjl_tzfree(timezone_t sp)
 
 #endif
 
-static const struct ttinfo *jjl_ttisp(struct state const *sp, const time_t t)
+/* JJL: Whether SP is always at the same offset, so there's nothing to look up */
+static bool
+jjl_is_fixed(struct state const *sp)
 {
-    register int            i;
-    if (sp->timecnt == 0 || t < sp->ats[0]) {
-        i = sp->defaulttype;
-    } else {
-        register int    lo = 1;
-        register int    hi = sp->timecnt;
+	return sp->timecnt == 0 && sp->leapcnt == 0 && !sp->hasrule;
+}
 
-        while (lo < hi) {
-            register int    mid = (lo + hi) >> 1;
+/* JJL: Whether SP's rule, rather than its transitions, has its type at T */
+static bool
+jjl_rule_applies(struct state const *sp, time_t t)
+{
+	return sp->hasrule && (sp->timecnt == 0 || sp->ats[sp->timecnt - 1] < t);
+}
 
-            if (t < sp->ats[mid])
-                hi = mid;
-            else    lo = mid + 1;
-        }
-        i = (int) sp->types[lo - 1];
-    }
+/*
+** JJL: jjl_rule_year, through SP's cache. Each word of an entry holds one of
+** the times with the year (plus one, so that 0 is no year) in its high half,
+** so any number of threads can fill entries at once without a lock: a reader
+** that finds the two words from different years just computes the year. The
+** times are a pure function of the year, so nothing else need be ordered.
+*/
+static bool
+jjl_rule_year_cached(struct state const *sp, int year, int_fast32_t *startp,
+		     int_fast32_t *endp)
+{
+	uint_least64_t *entry =
+		((struct state *) sp)->rulecache[year & (JJL_RULE_CACHE_SIZE - 1)];
+	uint_least64_t	tag = (uint_least64_t) ((uint_least32_t) year + 1) << 32;
+	uint_least64_t	start = __atomic_load_n(&entry[0], __ATOMIC_RELAXED);
+	uint_least64_t	end = __atomic_load_n(&entry[1], __ATOMIC_RELAXED);
+	bool		changes;
+
+	if (tag != 0 && (start & ~(uint_least64_t) UINT32_MAX) == tag
+	    && (end & ~(uint_least64_t) UINT32_MAX) == tag) {
+		*startp = (int_least32_t) (uint_least32_t) start;
+		*endp = (int_least32_t) (uint_least32_t) end;
+		/* A year without changes is cached with INT32_MIN as its start */
+		return *startp != INT32_MIN;
+	}
+	changes = jjl_rule_year(sp, year, startp, endp);
+	if (tag != 0) {
+		start = tag | (uint_least32_t) (changes ? *startp : INT32_MIN);
+		end = tag | (uint_least32_t) *endp;
+		__atomic_store_n(&entry[0], start, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry[1], end, __ATOMIC_RELAXED);
+	}
+	return changes;
+}
+
+/*
+** JJL: Put in ATS and TYPES, in order, the transitions of SP's rule in the
+** years from two before YEAR to two after, and return how many there are:
+** two for each year that changes, or 0 if the years are too far out.  A
+** rule with a time far from its day can put a year's transition past the
+** next year's, so the one before a time early in YEAR can be from two years
+** before.
+*/
+static int
+jjl_rule_transitions(struct state const *sp, int_fast64_t year, time_t *ats,
+		     int *types)
+{
+	register int	n = 0;
+	register int	y, i;
+
+	if (! (INT_MIN + 2 < year && year < INT_MAX - 2))
+		return 0;
+	for (y = year - 2; y <= year + 2; ++y) {
+		time_t		janfirst = jjl_civil_to_days(y, 0, 1) * SECSPERDAY;
+		int_fast32_t	starttime, endtime;
+
+		if (!jjl_rule_year_cached(sp, y, &starttime, &endtime))
+			continue;
+		ats[n] = janfirst + starttime;
+		types[n++] = sp->ruletypes[0];
+		ats[n] = janfirst + endtime;
+		types[n++] = sp->ruletypes[1];
+	}
+	for (i = 1; i < n; ++i)
+		for (y = i; 0 < y && ats[y] < ats[y - 1]; --y) {
+			time_t	at = ats[y];
+			int	type = types[y];
+
+			ats[y] = ats[y - 1];
+			types[y] = types[y - 1];
+			ats[y - 1] = at;
+			types[y - 1] = type;
+		}
+	return n;
+}
+
+/*
+** JJL: The year that T would be in if every year were the average length,
+** which is the UT year it's in except within a few days of the year's ends
+*/
+static int_fast64_t
+jjl_year_near(time_t t)
+{
+	int_fast64_t	days = t / SECSPERDAY - (t % SECSPERDAY < 0);
+	int_fast64_t	daysperrepeat = YEARSPERREPEAT * DAYSPERNYEAR
+					+ YEARSPERREPEAT / 4 - 3;
+	int_fast64_t	scaled = days * YEARSPERREPEAT;
+
+	return EPOCH_YEAR + (0 <= scaled ? scaled : scaled - (daysperrepeat - 1))
+			    / daysperrepeat;
+}
+
+/* JJL: The UT year that T is in */
+static int_fast64_t
+jjl_year_of(time_t t)
+{
+	int_fast64_t	days = t / SECSPERDAY - (t % SECSPERDAY < 0);
+	int_fast64_t	year = jjl_year_near(t);
+
+	if (days < jjl_civil_to_days(year, 0, 1))
+		return year - 1;
+	if (jjl_civil_to_days(year + 1, 0, 1) <= days)
+		return year + 1;
+	return year;
+}
+
+/*
+** JJL: Set [*LOP, *HIP) to the span between the transitions of SP's rule in
+** YEAR, and return the index in ruletypes of the type in it (the other is
+** the type outside it).  A rule's time is less than a week from its day, so
+** a transition more than a week from the year's ends can't have another
+** year's next to it, but return -1 for one that isn't, or if the year has
+** no changes.
+*/
+static int
+jjl_rule_span(struct state const *sp, int year, time_t *lop, time_t *hip)
+{
+	time_t		janfirst = jjl_civil_to_days(year, 0, 1) * SECSPERDAY;
+	int_fast32_t	starttime, endtime;
+	int_fast32_t	lo, hi;
+
+	if (!jjl_rule_year_cached(sp, year, &starttime, &endtime))
+		return -1;
+	lo = SMALLEST(starttime, endtime);
+	hi = BIGGEST(starttime, endtime);
+	if (lo < SECSPERDAY * DAYSPERWEEK
+	    || (year_lengths[isleap(year)] - DAYSPERWEEK) * SECSPERDAY < hi)
+		return -1;
+	*lop = janfirst + lo;
+	*hip = janfirst + hi;
+	return endtime < starttime;
+}
+
+/*
+** JJL: The type at T, where jjl_rule_applies, with [*STARTP, *ENDP) the part
+** of the period it's in that's past SP's last transition. Where the rule's
+** transitions aren't known around T, the range is just T's second.
+*/
+static int
+jjl_rule_period(struct state const *sp, time_t t, time_t *startp,
+		time_t *endp)
+{
+	int_fast64_t	year = jjl_year_near(t);
+	time_t		ats[10];
+	int		types[10];
+	time_t		lo, hi, nearlo, nearhi;
+	register int	i, n, type = -1;
+
+	*startp = t;
+	*endp = t < TIME_T_MAX ? t + 1 : t;
+	/* Nearly always between the year's own two, or between one of them
+	   and the nearer one of the year next to it.  YEAR is off by one
+	   within a few days of the new year, which its neighbor covers.  */
+	if (INT_MIN + 1 < year && year < INT_MAX - 1
+	    && 0 <= (i = jjl_rule_span(sp, year, &lo, &hi))) {
+		if (lo <= t && t < hi) {
+			*startp = lo;
+			*endp = hi;
+			type = sp->ruletypes[i];
+		} else if (t < lo
+			   && 0 <= (n = jjl_rule_span(sp, year - 1, &nearlo,
+						      &nearhi))
+			   && nearhi <= t) {
+			*startp = nearhi;
+			*endp = lo;
+			type = sp->ruletypes[!n];
+		} else if (hi <= t
+			   && 0 <= jjl_rule_span(sp, year + 1, &nearlo, &nearhi)
+			   && t < nearlo) {
+			*startp = hi;
+			*endp = nearlo;
+			type = sp->ruletypes[!i];
+		}
+	}
+	if (type < 0) {
+		n = jjl_rule_transitions(sp, jjl_year_of(t), ats, types);
+		for (i = 0; i < n && ats[i] <= t; ++i)
+			continue;
+		if (0 < i) {
+			type = types[i - 1];
+			*startp = ats[i - 1];
+		}
+		if (i < n) {
+			*endp = ats[i];
+			if (i == 0)
+				type = types[i] == sp->ruletypes[0]
+					? sp->ruletypes[1] : sp->ruletypes[0];
+		}
+		/* No changes for five years is perpetual DST, as in tzparse */
+		if (type < 0)
+			type = sp->ruletypes[0];
+	}
+	if (sp->timecnt != 0 && *startp <= sp->ats[sp->timecnt - 1]) {
+		*startp = sp->ats[sp->timecnt - 1];
+		return sp->types[sp->timecnt - 1];
+	}
+	return type;
+}
+
+static const struct ttinfo *jjl_ttisp(struct state const *sp, const time_t t)
+{
+    register int            n, i;
+    time_t                  start, end;
+
+    if (jjl_rule_applies(sp, t))
+        return &sp->ttis[jjl_rule_period(sp, t, &start, &end)];
+    n = jjl_count_through(sp->ats, sp->atsindex, sp->indexstart, sp->indexcnt, sp->timecnt, t);
+    i = n == 0 ? sp->defaulttype : (int) sp->types[n - 1];
     return &(sp->ttis[i]);
 }
 
@@ -1524,8 +3113,9 @@ localsub(struct state const *sp, time_t const *timep, int_fast32_t setname,
 	  /* Don't bother to set tzname etc.; tzset has already done it.  */
 	  return gmtsub(gmtptr, timep, 0, tmp);
 	}
-	if ((sp->goback && t < sp->ats[0]) ||
-		(sp->goahead && t > sp->ats[sp->timecnt - 1])) {
+	if (!jjl_is_fixed(sp) &&
+		((sp->goback && t < sp->ats[0]) ||
+		(sp->goahead && t > sp->ats[sp->timecnt - 1]))) {
 			time_t			newt = t;
 			register time_t		seconds;
 			register time_t		years;
@@ -1556,7 +3146,7 @@ localsub(struct state const *sp, time_t const *timep, int_fast32_t setname,
 			}
 			return result;
 	}
-    ttisp = jjl_ttisp(sp, t);
+	ttisp = jjl_is_fixed(sp) ? &sp->ttis[sp->defaulttype] : jjl_ttisp(sp, t);
 	/*
 	** To get (wrong) behavior that's compatible with System V Release 2.0
 	** you'd replace the statement below with
@@ -1577,12 +3167,98 @@ localsub(struct state const *sp, time_t const *timep, int_fast32_t setname,
 
 #if NETBSD_INSPIRED
 
+/*
+** JJL: The type for the wall time WALLTIME, which is at or past SP's last
+** transition's (TYPE is its type), where SP follows its rule: that of the
+** last of the rule's transitions after SP's own to have taken effect in wall
+** time, as jjl_set_wallats has it. Return -1 if the rule's transitions
+** aren't known around WALLTIME.
+*/
+static int
+jjl_rule_wall_type(struct state const *sp, time_t walltime, int type)
+{
+	time_t		ats[10];
+	int		types[10];
+	register int	i, n;
+
+	n = jjl_rule_transitions(sp, jjl_year_of(walltime), ats, types);
+	if (sp->timecnt == 0)
+		type = -1;
+	for (i = 0; i < n; ++i)
+		if ((sp->timecnt == 0 || sp->ats[sp->timecnt - 1] < ats[i])
+		    && ats[i] + sp->ttis[types[i]].tt_gmtoff <= walltime)
+			type = types[i];
+	return type;
+}
+
 struct tm *
 jjl_localtime_rz(struct state *sp, time_t const *timep, struct tm *tmp)
 {
   return localsub(sp, timep, 0, tmp);
 }
 
+bool
+jjl_wall_to_utc_z(struct state *sp, time_t walltime, time_t *utctimep)
+{
+	register int	i, n;
+	time_t		t = walltime;
+
+	if (sp == NULL || !sp->haswallats)
+		return false;
+	n = jjl_count_through(sp->wallats, sp->wallatsindex, sp->indexstart,
+			      sp->indexcnt, sp->timecnt, walltime);
+	i = n == 0 ? sp->defaulttype : (int) sp->types[n - 1];
+	if (sp->hasrule && n == sp->timecnt) {
+		i = jjl_rule_wall_type(sp, walltime, i);
+		if (i < 0)
+			return false;
+	}
+	if (increment_overflow_time(&t, -sp->ttis[i].tt_gmtoff))
+		return false;
+	/* Outside the table, localsub repeats the rules, so leave that to mktime */
+	if ((sp->goback && t < sp->ats[0]) ||
+	    (sp->goahead && t > sp->ats[sp->timecnt - 1]))
+		return false;
+	*utctimep = t;
+	return true;
+}
+
+/*
+** JJL: Set [*STARTP, *ENDP) to a range of times containing T throughout which
+** SP's UT offset, and the rest of what jjl_localtime_rz gives besides the
+** time itself, stays as it is at T, such that the wall time is simply the
+** time plus that offset.  The range is only ever part of that period, e.g.
+** it's just T's second where the rules repeat past the transitions, or with
+** leap seconds.
+*/
+void
+jjl_offset_range_z(struct state *sp, time_t t, time_t *startp, time_t *endp)
+{
+	register int	n;
+
+	*startp = t;
+	*endp = t < TIME_T_MAX ? t + 1 : t;
+	if (sp == NULL || jjl_is_fixed(sp)) {
+		*startp = TIME_T_MIN;
+		*endp = TIME_T_MAX;
+		return;
+	}
+	if (sp->leapcnt != 0 || (sp->goback && t < sp->ats[0]) ||
+	    (sp->goahead && t > sp->ats[sp->timecnt - 1]))
+		return;
+	if (jjl_rule_applies(sp, t)) {
+		jjl_rule_period(sp, t, startp, endp);
+		return;
+	}
+	n = jjl_count_through(sp->ats, sp->atsindex, sp->indexstart,
+			      sp->indexcnt, sp->timecnt, t);
+	*startp = n == 0 ? TIME_T_MIN : sp->ats[n - 1];
+	if (n < sp->timecnt)
+		*endp = sp->ats[n];
+	else if (!sp->goahead && !sp->hasrule)
+		*endp = TIME_T_MAX;
+}
+
 #endif
 
 static struct tm *
@@ -1664,22 +3340,58 @@ offtime(const time_t *timep, long offset)
 #endif /* defined STD_INSPIRED */
 
 /*
-** Return the number of leap years through the end of the given year
-** where, to make the math easy, the answer for year zero is defined as zero.
+** JJL: The number of days from 1970-01-01 to day MDAY of month MON (0-11) of
+** year Y, after Howard Hinnant's days_from_civil, which counts years from
+** March so that a leap day comes at the end of its year.  MDAY needn't be in
+** range, e.g. day 0 is the last day of the previous month.
 */
-
-static int
-leaps_thru_end_of_nonneg(int y)
+static int_fast64_t
+jjl_civil_to_days(int_fast64_t y, int mon, int mday)
 {
-  return y / 4 - y / 100 + y / 400;
+	register int_fast64_t	era, yoe, doy;
+
+	if (mon < 2)
+		--y;
+	era = (0 <= y ? y : y - (YEARSPERREPEAT - 1)) / YEARSPERREPEAT;
+	yoe = y - era * YEARSPERREPEAT;
+	doy = (153 * (mon < 2 ? mon + 10 : mon - 2) + 2) / 5
+		+ (int_fast64_t) mday - 1;
+	return era * (YEARSPERREPEAT * DAYSPERNYEAR + YEARSPERREPEAT / 4 - 3)
+		+ yoe * DAYSPERNYEAR + yoe / 4 - yoe / 100 + doy
+		- 719468;	/* 1970-01-01 from 0000-03-01 */
 }
 
-static int
-leaps_thru_end_of(register const int y)
+/*
+** JJL: The inverse of jjl_civil_to_days, also after Hinnant: set *YP, *MONP
+** (0-11), *MDAYP and *YDAYP to the date DAYS days after 1970-01-01.  It works
+** for any DAYS that a time_t divided by SECSPERDAY can be.
+*/
+static void
+jjl_days_to_civil(int_fast64_t days, int_fast64_t *yp, int *monp, int *mdayp,
+		  int *ydayp)
 {
-  return (y < 0
-	  ? -1 - leaps_thru_end_of_nonneg(-1 - y)
-	  : leaps_thru_end_of_nonneg(y));
+	register int_fast64_t	era, z;
+	register int		doe, yoe, doy, mp;
+	register int_fast64_t	daysperrepeat = YEARSPERREPEAT * DAYSPERNYEAR
+					+ YEARSPERREPEAT / 4 - 3;
+
+	z = days + 719468;	/* from 0000-03-01 */
+	era = (0 <= z ? z : z - (daysperrepeat - 1)) / daysperrepeat;
+	doe = z - era * daysperrepeat;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / (daysperrepeat - 1))
+		/ DAYSPERNYEAR;
+	doy = doe - (DAYSPERNYEAR * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;	/* months since March */
+	*mdayp = doy - (153 * mp + 2) / 5 + 1;
+	if (mp < 10) {
+		*yp = era * YEARSPERREPEAT + yoe;
+		*monp = mp + 2;
+		*ydayp = doy + 31 + 28 + isleap(*yp);
+	} else {
+		*yp = era * YEARSPERREPEAT + yoe + 1;
+		*monp = mp - 10;
+		*ydayp = doy - (DAYSPERNYEAR - 31 - 28);
+	}
 }
 
 static struct tm *
@@ -1687,11 +3399,9 @@ timesub(const time_t *timep, int_fast32_t offset,
 	const struct state *sp, struct tm *tmp)
 {
 	register const struct lsinfo *	lp;
-	register time_t			tdays;
-	register int			idays;	/* unsigned would be so 2003 */
+	register int_fast64_t		days;
 	register int_fast64_t		rem;
-	int				y;
-	register const int *		ip;
+	int_fast64_t			y;
 	register int_fast64_t		corr;
 	register bool			hit;
 	register int			i;
@@ -1708,70 +3418,25 @@ timesub(const time_t *timep, int_fast32_t offset,
 			break;
 		}
 	}
-	y = EPOCH_YEAR;
-	tdays = *timep / SECSPERDAY;
-	rem = *timep % SECSPERDAY;
-	while (tdays < 0 || tdays >= year_lengths[isleap(y)]) {
-		int		newy;
-		register time_t	tdelta;
-		register int	idelta;
-		register int	leapdays;
-
-		tdelta = tdays / DAYSPERLYEAR;
-		if (! ((! TYPE_SIGNED(time_t) || INT_MIN <= tdelta)
-		       && tdelta <= INT_MAX))
-		  goto out_of_range;
-		idelta = tdelta;
-		if (idelta == 0)
-			idelta = (tdays < 0) ? -1 : 1;
-		newy = y;
-		if (increment_overflow(&newy, idelta))
-		  goto out_of_range;
-		leapdays = leaps_thru_end_of(newy - 1) -
-			leaps_thru_end_of(y - 1);
-		tdays -= ((time_t) newy - y) * DAYSPERNYEAR;
-		tdays -= leapdays;
-		y = newy;
-	}
 	/*
-	** Given the range, we can now fearlessly cast...
+	** JJL: Split the time into days and seconds before applying the offset,
+	** which can't overflow then, and convert the days to a date directly
+	** rather than by stepping through years.
 	*/
-	idays = tdays;
-	rem += offset - corr;
-	while (rem < 0) {
+	days = *timep / SECSPERDAY;
+	rem = *timep % SECSPERDAY + offset - corr;
+	days += rem / SECSPERDAY;
+	rem %= SECSPERDAY;
+	if (rem < 0) {
 		rem += SECSPERDAY;
-		--idays;
-	}
-	while (rem >= SECSPERDAY) {
-		rem -= SECSPERDAY;
-		++idays;
-	}
-	while (idays < 0) {
-		if (increment_overflow(&y, -1))
-		  goto out_of_range;
-		idays += year_lengths[isleap(y)];
-	}
-	while (idays >= year_lengths[isleap(y)]) {
-		idays -= year_lengths[isleap(y)];
-		if (increment_overflow(&y, 1))
-		  goto out_of_range;
-	}
-	tmp->tm_year = y;
-	if (increment_overflow(&tmp->tm_year, -TM_YEAR_BASE))
-	  goto out_of_range;
-	tmp->tm_yday = idays;
-	/*
-	** The "extra" mods below avoid overflow problems.
-	*/
-	tmp->tm_wday = EPOCH_WDAY +
-		((y - EPOCH_YEAR) % DAYSPERWEEK) *
-		(DAYSPERNYEAR % DAYSPERWEEK) +
-		leaps_thru_end_of(y - 1) -
-		leaps_thru_end_of(EPOCH_YEAR - 1) +
-		idays;
-	tmp->tm_wday %= DAYSPERWEEK;
-	if (tmp->tm_wday < 0)
-		tmp->tm_wday += DAYSPERWEEK;
+		--days;
+	}
+	jjl_days_to_civil(days, &y, &tmp->tm_mon, &tmp->tm_mday, &tmp->tm_yday);
+	if (! (INT_MIN + TM_YEAR_BASE <= y && y <= INT_MAX))
+		goto out_of_range;
+	tmp->tm_year = y - TM_YEAR_BASE;
+	tmp->tm_wday = (EPOCH_WDAY + days % DAYSPERWEEK + DAYSPERWEEK)
+		% DAYSPERWEEK;
 	tmp->tm_hour = (int) (rem / SECSPERHOUR);
 	rem %= SECSPERHOUR;
 	tmp->tm_min = (int) (rem / SECSPERMIN);
@@ -1780,10 +3445,6 @@ timesub(const time_t *timep, int_fast32_t offset,
 	** representation. This uses "... ??:59:60" et seq.
 	*/
 	tmp->tm_sec = (int) (rem % SECSPERMIN) + hit;
-	ip = mon_lengths[isleap(y)];
-	for (tmp->tm_mon = 0; idays >= ip[tmp->tm_mon]; ++(tmp->tm_mon))
-		idays -= ip[tmp->tm_mon];
-	tmp->tm_mday = (int) (idays + 1);
 	tmp->tm_isdst = 0;
 #ifdef TM_GMTOFF
 	tmp->TM_GMTOFF = offset;
@@ -2178,6 +3839,12 @@ time1(struct tm *const tmp,
 	for (i = 0; i < sp->typecnt; ++i)
 		seen[i] = false;
 	nseen = 0;
+	/* JJL: The rule's types are the latest.  */
+	for (i = 0; sp->hasrule && i < 2; ++i)
+		if (!seen[sp->ruletypes[i]]) {
+			seen[sp->ruletypes[i]] = true;
+			types[nseen++] = sp->ruletypes[i];
+		}
 	for (i = sp->timecnt - 1; i >= 0; --i)
 		if (!seen[sp->types[i]]) {
 			seen[sp->types[i]] = true;
@@ -2205,9 +3872,48 @@ time1(struct tm *const tmp,
 	return WRONG;
 }
 
+/*
+** JJL: mktime for a zone with a fixed offset, which is a calculation rather
+** than time1's search. It fails where time1 would, when TMP asks for a kind
+** of time (standard or daylight saving) that the zone doesn't have.
+*/
+static time_t
+jjl_fixed_time(struct state const *sp, struct tm *tmp, bool setname)
+{
+	register const struct ttinfo *	ttisp = &sp->ttis[sp->defaulttype];
+	int_fast64_t			y, mon, days, secs;
+	time_t				t;
+
+	if (tmp == NULL) {
+		errno = EINVAL;
+		return WRONG;
+	}
+	if (0 <= tmp->tm_isdst && (0 < tmp->tm_isdst) != ttisp->tt_isdst)
+		return WRONG;
+	mon = tmp->tm_mon;
+	y = mon >= 0 ? mon / MONSPERYEAR : -1 - (-1 - mon) / MONSPERYEAR;
+	mon -= y * MONSPERYEAR;
+	y += (int_fast64_t) tmp->tm_year + TM_YEAR_BASE;
+	days = jjl_civil_to_days(y, mon, tmp->tm_mday);
+	/* None of this can overflow, since each field is an int */
+	secs = days * SECSPERDAY + (int_fast64_t) tmp->tm_hour * SECSPERHOUR
+		+ (int_fast64_t) tmp->tm_min * SECSPERMIN + tmp->tm_sec
+		- ttisp->tt_gmtoff;
+	if (! (TIME_T_MIN <= secs && secs <= TIME_T_MAX)) {
+		errno = EOVERFLOW;
+		return WRONG;
+	}
+	t = secs;
+	if (! localsub(sp, &t, setname, tmp))
+		return WRONG;
+	return t;
+}
+
 static time_t
 mktime_tzname(struct state *sp, struct tm *tmp, bool setname)
 {
+  if (sp && jjl_is_fixed(sp))
+    return jjl_fixed_time(sp, tmp, setname);
   if (sp)
     return time1(tmp, localsub, sp, setname);
   else {
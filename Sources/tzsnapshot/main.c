@@ -0,0 +1,51 @@
+//Copyright (c) 2018 Michael Eisel. All rights reserved.
+
+// Compiles zones into a snapshot for jjl_tzsnapshot_open, or with -c, into C tables for building with JJL_TZ_EMBEDDED. The zones are named
+// on the command line, or else one per line on stdin, e.g.:
+//   (cd /usr/share/zoneinfo && find * -type f) | tzsnapshot zones.snapshot
+//   tzsnapshot -c Sources/tzdb/tzembedded.h GMT UTC America/New_York Europe/London
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tzdb.h"
+
+int main(int argc, char **argv) {
+    char const *program = argv[0];
+    int embed = argc > 1 && strcmp(argv[1], "-c") == 0;
+    argc -= embed;
+    argv += embed;
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s [-c] output [zone ...]\n", program);
+        return 2;
+    }
+    char **names = argv + 2;
+    int count = argc - 2;
+    if (count == 0) {
+        int capacity = 0;
+        char line[1024];
+        names = NULL;
+        while (fgets(line, sizeof(line), stdin)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 512;
+                names = realloc(names, capacity * sizeof(*names));
+            }
+            if (!names || !(names[count] = strdup(line))) {
+                fprintf(stderr, "%s: out of memory\n", program);
+                return 1;
+            }
+            count++;
+        }
+    }
+    int written = embed
+        ? jjl_tzembed_write(argv[1], (char const *const *)names, count)
+        : jjl_tzsnapshot_write(argv[1], (char const *const *)names, count);
+    if (written < 0) {
+        fprintf(stderr, "%s: %s: %s\n", program, argv[1], strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "%s: wrote %d of %d zones\n", program, written, count);
+    return 0;
+}
@@ -153,6 +153,76 @@ final class JJLISO8601DateFormatterTests: XCTestCase {
         let goodTimezone = "Africa/Addis_Ababa".withCString { jjl_tzalloc($0) }
         XCTAssertNotNil(goodTimezone)
     }
+
+    func testTruncatedTimeZoneFile() {
+        // A version 2 file whose version 1 data ends a page exactly at the end of the file, without the 64-bit data that should follow
+        var bytes = [UInt8](repeating: 0, count: 4096)
+        func put(_ value: UInt32, at offset: Int) {
+            withUnsafeBytes(of: value.bigEndian) { bytes.replaceSubrange(offset..<offset + 4, with: $0) }
+        }
+        bytes.replaceSubrange(0..<5, with: Array("TZif2".utf8))
+        let timeCount = 808, typeCount = 1, charCount = 6
+        put(UInt32(timeCount), at: 32)
+        put(UInt32(typeCount), at: 36)
+        put(UInt32(charCount), at: 40)
+        for i in 0..<timeCount {
+            put(UInt32(i), at: 44 + 4 * i)
+        }
+        bytes.replaceSubrange(bytes.count - charCount..<bytes.count - charCount + 3, with: Array("UTC".utf8))
+        let path = (NSTemporaryDirectory() as NSString).appendingPathComponent("JJLTruncatedTimeZoneTest-\(getpid())")
+        defer { try? FileManager.default.removeItem(atPath: path) }
+        XCTAssertTrue(FileManager.default.createFile(atPath: path, contents: Data(bytes)))
+        XCTAssertNil(path.withCString { jjl_tzalloc($0) })
+    }
+    
+    func testTimeZoneSnapshot() {
+        let names = ["America/Los_Angeles", "America/Sao_Paulo", "Asia/Kolkata", "Europe/London", "America/adf"]
+        let path = (NSTemporaryDirectory() as NSString).appendingPathComponent("JJLTimeZoneSnapshotTest-\(getpid())")
+        defer { try? FileManager.default.removeItem(atPath: path) }
+        let cNames = names.map { strdup($0) }
+        defer { cNames.forEach { free($0) } }
+        let written = cNames.map { UnsafePointer($0) }.withUnsafeBufferPointer { jjl_tzsnapshot_write(path, $0.baseAddress, Int32($0.count)) }
+        XCTAssertEqual(written, 4)
+        let loaded = names.map { name in name.withCString { jjl_tzalloc($0) } }
+        XCTAssertFalse(JJLISO8601DateFormatter.useTimeZoneSnapshot(atPath: path + ".missing"))
+        XCTAssertTrue(JJLISO8601DateFormatter.useTimeZoneSnapshot(atPath: path))
+        for (name, fromFile) in zip(names, loaded) {
+            let fromSnapshot = name.withCString { jjl_tzalloc($0) }
+            XCTAssertEqual(fromSnapshot == nil, fromFile == nil)
+            guard let fromSnapshot = fromSnapshot, let fromFile = fromFile else {
+                continue
+            }
+            for i in stride(from: -2_000_000_000, to: 4_000_000_000, by: 3_000_017) {
+                var time = time_t(i)
+                var snapshotTm = tm()
+                var fileTm = tm()
+                jjl_localtime_rz(fromSnapshot, &time, &snapshotTm)
+                jjl_localtime_rz(fromFile, &time, &fileTm)
+                XCTAssertEqual(snapshotTm.tm_gmtoff, fileTm.tm_gmtoff)
+                XCTAssertEqual(String(cString: snapshotTm.tm_zone), String(cString: fileTm.tm_zone))
+            }
+            jjl_tzfree(fromSnapshot)
+            jjl_tzfree(fromFile)
+        }
+        let timeZone = TimeZone(identifier: "Asia/Kolkata")!
+        appleFormatter.timeZone = timeZone
+        testFormatter.timeZone = timeZone
+        for date in [testDate!, Date(timeIntervalSince1970: 0)] {
+            testStringFromDate(date, appleFormatter: appleFormatter, testFormatter: testFormatter)
+        }
+    }
+    
+    func testEmbeddedTimeZoneTables() {
+        let path = (NSTemporaryDirectory() as NSString).appendingPathComponent("JJLTimeZoneTablesTest-\(getpid()).h")
+        defer { try? FileManager.default.removeItem(atPath: path) }
+        let cNames = ["UTC", "America/Los_Angeles", "GMT", "UTC", "America/adf"].map { strdup($0) }
+        defer { cNames.forEach { free($0) } }
+        let written = cNames.map { UnsafePointer($0) }.withUnsafeBufferPointer { jjl_tzembed_write(path, $0.baseAddress, Int32($0.count)) }
+        XCTAssertEqual(written, 3)
+        let tables = try? String(contentsOfFile: path)
+        XCTAssertNotNil(tables?.range(of: "jjl_embedded_states"))
+        XCTAssertNotNil(tables?.range(of: "\"America/Los_Angeles\""))
+    }
     
     func testClassStringFromDate() {
         for timeZone in [pacificTimeZone!, brazilTimeZone!] {
@@ -237,6 +307,24 @@ final class JJLISO8601DateFormatterTests: XCTestCase {
         testString("2018-08-17T02:14:02.662762Z", appleFormatter: appleFormatter, testFormatter: testFormatter)
     }
     
+    func testFixedLayoutParsing() {
+        // Strings that are in, or just off of, the fixed internet date time layout that the vectorized parser handles
+        let strings = [
+            "2018-09-13T19:56:48.980Z", "2018-09-13T16:56:48.980-03:00", "2018-09-14T04:56:48.980+09:00",
+            "2018-09-13T19:56:48,980Z", "2018-09-13T19:56:48.98Z", "2018-09-13T19:56:48.9801Z", "2018-09-13T19:56:48Z",
+            "2018-09-13 19:56:48.980Z", "2018-09-13T19:56:48.980+0900", "2018-09-13T19:56:48.980+09:00:30",
+            "2018:09:13T19:56:48.980Z", "2018-13-13T19:56:48.980Z", "2018-00-13T19:56:48.980Z", "2018-09-1aT19:56:48.980Z",
+            "0001-01-01T00:00:00.000Z", "9999-12-31T23:59:59.999Z"
+        ]
+        for options in [appleFormatter.formatOptions, [.withInternetDateTime], [.withInternetDateTime, .withSpaceBetweenDateAndTime]] {
+            appleFormatter.formatOptions = options
+            testFormatter.formatOptions = options
+            for string in strings {
+                testString(string, appleFormatter: appleFormatter, testFormatter: testFormatter)
+            }
+        }
+    }
+    
     func testLeapSeconds() {
         let interval = appleFormatter.date(from: "2016-12-31T23:59:58.000Z")!.timeIntervalSince1970
         testDatesInParallel(startInterval: interval, endInterval: interval + 4, increment: 0.01)
@@ -373,6 +461,349 @@ final class JJLISO8601DateFormatterTests: XCTestCase {
         }
     }
     
+    func testLocalTimeParsingAroundTransitions() {
+        // Strings without a time zone, around the 2017 spring forward (2:00 to 3:00) and fall back (2:00 to 1:00),
+        // including wall times that are skipped or repeated
+        let options: ISO8601DateFormatter.Options = [.withFullDate, .withTime, .withColonSeparatorInTime]
+        appleFormatter.formatOptions = options
+        testFormatter.formatOptions = options
+        appleFormatter.timeZone = pacificTimeZone
+        testFormatter.timeZone = pacificTimeZone
+        for day in ["2017-03-12", "2017-11-05"] {
+            for minutes in stride(from: 0, to: 4 * 60, by: 10) {
+                let string = String(format: "%@T%02d:%02d:00", day, minutes / 60, minutes % 60)
+                testString(string, appleFormatter: appleFormatter, testFormatter: testFormatter)
+            }
+        }
+    }
+    
+    func testFixedOffsetTimeZones() {
+        let fixed = jjl_tzalloc_fixed(5 * Self.secondsPerHour + 30 * Self.secondsPerMinute)!
+        defer { jjl_tzfree(fixed) }
+        var time = time_t(0)
+        var components = tm()
+        jjl_localtime_rz(fixed, &time, &components)
+        XCTAssertEqual(String(cString: components.tm_zone), "+0530")
+        XCTAssertEqual(components.tm_hour, 5)
+        XCTAssertEqual(jjl_mktime_z(fixed, &components), 0)
+        XCTAssertNil(jjl_tzalloc_fixed(Self.secondsPerDay))
+        
+        // Includes offsets that aren't whole minutes, which Apple's formatter truncates
+        let offsets = [0, 3600, -3600, 19800, -34200, 50400, -43200, 496, -2 * Self.secondsPerHour - 496]
+        let options: ISO8601DateFormatter.Options = [.withFullDate, .withTime, .withColonSeparatorInTime]
+        for offset in offsets {
+            let timeZone = TimeZone(secondsFromGMT: offset)!
+            appleFormatter.timeZone = timeZone
+            testFormatter.timeZone = timeZone
+            appleFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+            testFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+            for interval in stride(from: -Double(100 * Self.secondsPerYear), to: Double(100 * Self.secondsPerYear), by: 7_654_321.123) {
+                testStringFromDate(Date(timeIntervalSince1970: interval), appleFormatter: appleFormatter, testFormatter: testFormatter)
+            }
+            // Strings without a time zone are in the formatter's
+            appleFormatter.formatOptions = options
+            testFormatter.formatOptions = options
+            for string in ["2017-03-12T02:30:00", "1900-01-01T00:00:00", "2100-12-31T23:59:59"] {
+                testString(string, appleFormatter: appleFormatter, testFormatter: testFormatter)
+            }
+        }
+    }
+
+    func testTimeZoneHandles() {
+        let handle = JJLISO8601DateFormatter.timeZoneHandle(for: TimeZone(secondsFromGMT: 8 * Self.secondsPerHour)!)
+        XCTAssertNotNil(handle)
+        // The same offset under other names shares a zone
+        XCTAssertEqual(handle, JJLISO8601DateFormatter.timeZoneHandle(for: TimeZone(identifier: "GMT+08:00")!))
+        let invalid = JJLAcquireTimeZoneHandle("America/adf", 11)
+        XCTAssertNil(JJLTimeZoneForHandle(invalid))
+        JJLReleaseTimeZoneHandle(invalid)
+
+        let options: ISO8601DateFormatter.Options = [.withInternetDateTime, .withFractionalSeconds]
+        for identifier in ["America/New_York", "Asia/Kolkata", "GMT+0800"] {
+            let timeZone = TimeZone(identifier: identifier)!
+            let handle = JJLISO8601DateFormatter.timeZoneHandle(for: timeZone)!
+            for interval in stride(from: -Double(10 * Self.secondsPerYear), to: Double(10 * Self.secondsPerYear), by: 1_234_567.891) {
+                let date = Date(timeIntervalSince1970: interval)
+                XCTAssertEqual(JJLISO8601DateFormatter.string(from: date, timeZoneHandle: handle, formatOptions: options), JJLISO8601DateFormatter.string(from: date, timeZone: timeZone, formatOptions: options))
+            }
+        }
+    }
+
+    func testTimeZoneCacheEviction() {
+        let capacity = JJLISO8601DateFormatter.timeZoneCacheCapacity
+        defer { JJLISO8601DateFormatter.timeZoneCacheCapacity = capacity }
+        JJLISO8601DateFormatter.timeZoneCacheCapacity = 2
+        
+        // A formatter's zone is pinned, so it stays loaded however many others are used
+        let formatter = JJLISO8601DateFormatter()
+        formatter.timeZone = TimeZone(identifier: "Asia/Kolkata")!
+        let date = Date(timeIntervalSince1970: 1_700_000_000)
+        let expected = formatter.string(from: date)
+        let before = JJLISO8601DateFormatter.timeZoneCacheStatistics
+        for identifier in ["America/New_York", "Europe/London", "Asia/Tokyo", "Australia/Sydney", "America/Los_Angeles"] {
+            let timeZone = TimeZone(identifier: identifier)!
+            XCTAssertNotNil(JJLISO8601DateFormatter.timeZoneHandle(for: timeZone))
+            XCTAssertEqual(formatter.string(from: date), expected)
+        }
+        let after = JJLISO8601DateFormatter.timeZoneCacheStatistics
+        XCTAssertGreaterThan(after.evictions, before.evictions)
+        // GMT, which testFormatter pins, and Asia/Kolkata go over capacity, but nothing else can
+        XCTAssertLessThanOrEqual(after.count, 3)
+        
+        // Lookups of a zone that's still cached are hits
+        let handle = JJLISO8601DateFormatter.timeZoneHandle(for: TimeZone(identifier: "Asia/Kolkata")!)
+        XCTAssertNotNil(handle)
+        XCTAssertEqual(JJLISO8601DateFormatter.timeZoneCacheStatistics.hits, after.hits + 1)
+        XCTAssertEqual(JJLISO8601DateFormatter.timeZoneCacheStatistics.misses, after.misses)
+    }
+
+    func testReplacedSettingsAreReleased() {
+        let capacity = JJLISO8601DateFormatter.timeZoneCacheCapacity
+        defer { JJLISO8601DateFormatter.timeZoneCacheCapacity = capacity }
+        JJLISO8601DateFormatter.timeZoneCacheCapacity = 2
+        
+        // A formatter whose zone keeps changing only pins the one it has now, so the others can be evicted
+        let formatter = JJLISO8601DateFormatter()
+        let date = Date(timeIntervalSince1970: 1_700_000_000)
+        for identifier in ["America/New_York", "Europe/London", "Asia/Tokyo", "Australia/Sydney", "America/Los_Angeles", "Europe/Paris"] {
+            formatter.timeZone = TimeZone(identifier: identifier)!
+            XCTAssertFalse(formatter.string(from: date).isEmpty)
+        }
+        JJLReclaimRetired()
+        // GMT, which testFormatter pins, and Europe/Paris go over capacity, but nothing else can
+        XCTAssertNotNil(JJLISO8601DateFormatter.timeZoneHandle(for: TimeZone(identifier: "Asia/Kolkata")!))
+        XCTAssertLessThanOrEqual(JJLISO8601DateFormatter.timeZoneCacheStatistics.count, 3)
+    }
+
+    func testSynthesizedTimeZones() {
+        // Zones with a rule now, zones that dropped daylight saving time, and ones whose standard offset has changed
+        let identifiers = ["America/New_York", "Europe/London", "Australia/Sydney", "Australia/Lord_Howe", "Europe/Dublin", "America/Sao_Paulo",
+                           "Asia/Kolkata", "Europe/Moscow", "Africa/Casablanca", "Pacific/Apia"]
+        for identifier in identifiers {
+            let timeZone = TimeZone(identifier: identifier)!
+            guard let synthesized = JJLISO8601DateFormatter.synthesizedCTimeZone(for: timeZone) else {
+                XCTFail("Couldn't synthesize \(identifier)")
+                continue
+            }
+            defer { jjl_tzfree(synthesized) }
+            for interval in stride(from: -Double(70 * Self.secondsPerYear), to: Double(100 * Self.secondsPerYear), by: 86_413.7) {
+                let date = Date(timeIntervalSince1970: interval)
+                var time = time_t(interval.rounded(.down))
+                var components = tm()
+                jjl_localtime_rz(synthesized, &time, &components)
+                XCTAssertEqual(components.tm_gmtoff, timeZone.secondsFromGMT(for: date), "\(identifier) at \(date)")
+            }
+        }
+    }
+
+    func testPOSIXTimeZones() {
+        let options: ISO8601DateFormatter.Options = [.withInternetDateTime]
+        let posix = JJLISO8601DateFormatter.timeZoneHandle(forPOSIXString: "EST5EDT,M3.2.0,M11.1.0")!
+        let newYork = JJLISO8601DateFormatter.timeZoneHandle(for: TimeZone(identifier: "America/New_York")!)!
+        // New York has followed the rule since 2007, and the rule goes on indefinitely
+        for interval in stride(from: 1_168_000_000.0, to: Double(400 * Self.secondsPerYear), by: 3_456_789.1) {
+            let date = Date(timeIntervalSince1970: interval)
+            XCTAssertEqual(JJLISO8601DateFormatter.string(from: date, timeZoneHandle: posix, formatOptions: options), JJLISO8601DateFormatter.string(from: date, timeZoneHandle: newYork, formatOptions: options))
+        }
+        // 2400-07-01T12:00:00Z
+        let farFuture = Date(timeIntervalSince1970: 13_585_233_600)
+        XCTAssertEqual(JJLISO8601DateFormatter.string(from: farFuture, timeZoneHandle: posix, formatOptions: options), "2400-07-01T08:00:00-04:00")
+        let fixed = JJLISO8601DateFormatter.timeZoneHandle(forPOSIXString: "<+0530>-5:30")!
+        XCTAssertEqual(JJLISO8601DateFormatter.string(from: farFuture, timeZoneHandle: fixed, formatOptions: options), "2400-07-01T17:30:00+05:30")
+        // The calendar repeats every 400 years, including before year 1
+        let timeOptions: ISO8601DateFormatter.Options = [.withFullTime]
+        let secondsPer400Years = 146_097.0 * 86_400
+        for interval in stride(from: 1_168_000_000.0, to: 1_168_000_000.0 + secondsPer400Years, by: 3_456_789.1) {
+            let date = Date(timeIntervalSince1970: interval)
+            let farPast = Date(timeIntervalSince1970: interval - 10 * secondsPer400Years)
+            XCTAssertEqual(JJLISO8601DateFormatter.string(from: farPast, timeZoneHandle: posix, formatOptions: timeOptions), JJLISO8601DateFormatter.string(from: date, timeZoneHandle: posix, formatOptions: timeOptions))
+        }
+        // Names aren't rules
+        for string in ["", "America/New_York", ":EST5EDT", "EST5EDT,M3.2.0"] {
+            XCTAssertNil(JJLISO8601DateFormatter.timeZoneHandle(forPOSIXString: string), string)
+        }
+    }
+
+    func testEpochFormatting() {
+        appleFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        testFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        for timeZone in [pacificTimeZone!, TimeZone(secondsFromGMT: 0)!] {
+            appleFormatter.timeZone = timeZone
+            testFormatter.timeZone = timeZone
+            for milliseconds in stride(from: Int64(0), to: Int64(60 * Self.secondsPerYear) * 1_000, by: 98_765_432_109) {
+                let expected = appleFormatter.string(from: Date(timeIntervalSince1970: TimeInterval(milliseconds / 1_000)) + TimeInterval(milliseconds % 1_000) / 1_000)
+                XCTAssertEqual(testFormatter.string(fromEpochMilliseconds: milliseconds), expected)
+                XCTAssertEqual(testFormatter.string(fromEpochMicroseconds: milliseconds * 1_000 + 999), expected)
+                XCTAssertEqual(testFormatter.string(fromEpochNanoseconds: milliseconds * 1_000_000 + 999_999), expected)
+                XCTAssertEqual(testFormatter.string(fromEpochSeconds: milliseconds / 1_000, nanoseconds: Int32(milliseconds % 1_000) * 1_000_000), expected)
+            }
+        }
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 0)!
+        XCTAssertEqual(testFormatter.string(fromEpochMilliseconds: -1), "1969-12-31T23:59:59.999Z")
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: 0, nanoseconds: -1), "1969-12-31T23:59:59.999Z")
+        XCTAssertEqual(testFormatter.string(fromEpochNanoseconds: 1_999_999_999), "1970-01-01T00:00:01.999Z")
+        // The year doesn't fit in an int
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: .max), "")
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: .min), "")
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 14 * Self.secondsPerHour)!
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: .max - 1), "")
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 0)!
+        // Carrying the nanoseconds would overflow the seconds
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: .max, nanoseconds: 1_000_000_000), "")
+        XCTAssertEqual(testFormatter.string(fromEpochSeconds: .min, nanoseconds: -1), "")
+    }
+    
+    func testFractionalSecondDigits() {
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 0)!
+        testFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        XCTAssertEqual(testFormatter.fractionalSecondDigits, 3)
+        let expected = ["2018-09-13T19:56:48Z", "2018-09-13T19:56:48.1Z", "2018-09-13T19:56:48.123Z", "2018-09-13T19:56:48.123456Z", "2018-09-13T19:56:48.123456789Z"]
+        for (digits, string) in zip([0, 1, 3, 6, 9], expected) {
+            testFormatter.fractionalSecondDigits = digits
+            XCTAssertEqual(testFormatter.string(fromEpochSeconds: 1_536_868_608, nanoseconds: 123_456_789), string)
+            // Parsing keeps the same number of digits
+            let parsed = testFormatter.date(from: "2018-09-13T19:56:48.123456789Z")
+            if digits == 0 {
+                XCTAssertNil(parsed)
+            } else {
+                let fraction = Double(123_456_789 / Int(pow(10, Double(9 - digits)))) / pow(10, Double(digits))
+                XCTAssertEqual(parsed?.timeIntervalSince1970, 1_536_868_608 + fraction)
+            }
+        }
+        testFormatter.fractionalSecondDigits = 6
+        let date = testFormatter.date(from: "2018-09-13T19:56:48.000250Z")!
+        XCTAssertEqual(testFormatter.string(from: date), "2018-09-13T19:56:48.000250Z")
+        
+        // The default matches Apple, including ignoring digits past the milliseconds
+        testFormatter.fractionalSecondDigits = 3
+        appleFormatter.timeZone = testFormatter.timeZone
+        appleFormatter.formatOptions = testFormatter.formatOptions
+        testString("2018-09-13T19:56:48.1239Z", appleFormatter: appleFormatter, testFormatter: testFormatter)
+    }
+    
+    func testEpochParsing() {
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 0)!
+        testFormatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        testFormatter.fractionalSecondDigits = 9
+        let parsed = testFormatter.epochSeconds(from: "2018-09-13T19:56:48.123456789+01:00")
+        XCTAssertEqual(parsed?.seconds, 1_536_865_008)
+        XCTAssertEqual(parsed?.nanoseconds, 123_456_789)
+        XCTAssertEqual(testFormatter.epochNanoseconds(from: "2018-09-13T19:56:48.123456789Z"), 1_536_868_608_123_456_789)
+        XCTAssertEqual(testFormatter.epochNanoseconds(from: "1969-12-31T23:59:59.999999999Z"), -1)
+        XCTAssertEqual(testFormatter.epochNanoseconds(from: "2262-04-11T23:47:16.854775807Z"), Int64.max)
+        XCTAssertEqual(testFormatter.epochNanoseconds(from: "1677-09-21T00:12:43.145224192Z"), Int64.min)
+        XCTAssertNil(testFormatter.epochNanoseconds(from: "2262-04-11T23:47:16.854775808Z"))
+        XCTAssertNil(testFormatter.epochNanoseconds(from: "2018-09-13"))
+        XCTAssertNotNil(testFormatter.epochSeconds(from: "3000-01-01T00:00:00.000000000Z"))
+        
+        // At the default precision, it agrees with date(from:)
+        testFormatter.fractionalSecondDigits = 3
+        let string = "2018-09-13T19:56:48.987654Z"
+        XCTAssertEqual(testFormatter.epochNanoseconds(from: string), 1_536_868_608_987_000_000)
+        XCTAssertEqual(testFormatter.date(from: string)?.timeIntervalSince1970, 1_536_868_608.987)
+    }
+
+    func testFormattingContext() {
+        for options: ISO8601DateFormatter.Options in [[.withInternetDateTime, .withFractionalSeconds], [.withFullTime], [.withFullDate]] {
+            testFormatter.formatOptions = options
+            testFormatter.fractionalSecondDigits = 6
+            // Across the start of daylight saving time and a day boundary, in a zone with an offset that's not a whole number of hours
+            for timeZone in [pacificTimeZone!, TimeZone(identifier: "Asia/Kolkata")!, TimeZone(secondsFromGMT: 0)!] {
+                testFormatter.timeZone = timeZone
+                let context = testFormatter.makeFormattingContext()
+                var microseconds: Int64 = 1_520_762_400_000_000 - 3_600_000_000
+                for step in 0..<5_000 {
+                    microseconds += Int64(step % 7 == 0 ? 1_733_000_017 : 98_765)
+                    let seconds = microseconds / 1_000_000
+                    let nanoseconds = Int32(microseconds % 1_000_000) * 1_000
+                    XCTAssertEqual(context.string(fromEpochSeconds: seconds, nanoseconds: nanoseconds), testFormatter.string(fromEpochMicroseconds: microseconds))
+                }
+                let date = Date(timeIntervalSince1970: 1_536_868_608.9996)
+                XCTAssertEqual(context.string(from: date), testFormatter.string(from: date))
+                // Like the formatter, nothing for a year that doesn't fit in an int
+                for seconds in [Int64.max, .min] {
+                    XCTAssertEqual(context.string(fromEpochSeconds: seconds), "")
+                    XCTAssertEqual(context.string(fromEpochSeconds: seconds), testFormatter.string(fromEpochSeconds: seconds))
+                }
+                XCTAssertEqual(context.string(from: date), testFormatter.string(from: date))
+            }
+        }
+        // Later changes to the formatter don't affect the context
+        let context = testFormatter.makeFormattingContext()
+        testFormatter.formatOptions = [.withInternetDateTime]
+        XCTAssertEqual(context.string(fromEpochSeconds: 0), "1970-01-01")
+    }
+
+    func testSettersKeepOtherSettings() {
+        let formatter = JJLISO8601DateFormatter()
+        let gmt = TimeZone(identifier: "GMT")!
+        let newYork = TimeZone(identifier: "America/New_York")!
+        let date = Date(timeIntervalSince1970: 1_000_000_000)
+        // Going back to earlier settings, then changing another one
+        formatter.timeZone = newYork
+        formatter.timeZone = gmt
+        formatter.formatOptions = [.withFullDate]
+        XCTAssertEqual(formatter.timeZone, gmt)
+        XCTAssertEqual(formatter.formatOptions, [.withFullDate])
+        XCTAssertEqual(formatter.string(from: date), "2001-09-09")
+        formatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        formatter.fractionalSecondDigits = 6
+        formatter.timeZone = newYork
+        formatter.fractionalSecondDigits = 3
+        formatter.formatOptions = [.withInternetDateTime]
+        formatter.formatOptions = [.withInternetDateTime, .withFractionalSeconds]
+        XCTAssertEqual(formatter.timeZone, newYork)
+        XCTAssertEqual(formatter.formatOptions, [.withInternetDateTime, .withFractionalSeconds])
+        XCTAssertEqual(formatter.fractionalSecondDigits, 3)
+        XCTAssertEqual(formatter.string(from: date), "2001-09-08T21:46:40.000-04:00")
+    }
+
+    func testChangingSettingsWhileInUse() {
+        testFormatter.formatOptions = [.withInternetDateTime]
+        testFormatter.timeZone = TimeZone(secondsFromGMT: 0)!
+        let date = Date(timeIntervalSince1970: 0)
+        let expected: Set<String> = ["1970-01-01T00:00:00Z", "1970-01-01T01:00:00+01:00", "1970-01-01T00:00:00.000Z", "1970-01-01T01:00:00.000+01:00"]
+        let writer = DispatchQueue(label: "writer")
+        writer.async { [testFormatter] in
+            for i in 0..<1_000 {
+                testFormatter!.timeZone = TimeZone(secondsFromGMT: i % 2 == 0 ? 3_600 : 0)!
+                testFormatter!.formatOptions = i % 3 == 0 ? [.withInternetDateTime, .withFractionalSeconds] : [.withInternetDateTime]
+            }
+        }
+        // Every string has to come from one whole set of settings or another, never a mix
+        DispatchQueue.concurrentPerform(iterations: 8) { _ in
+            for _ in 0..<10_000 {
+                let string = testFormatter.string(from: date)
+                XCTAssertTrue(expected.contains(string), string)
+                // Whether it parses depends on whether fractional seconds are expected at the time, but it's never the wrong date
+                if let parsed = testFormatter.date(from: string) {
+                    XCTAssertEqual(parsed, date)
+                }
+            }
+        }
+        writer.sync {}
+    }
+
+    func testParsingContext() {
+        // The default options, which have their own fast path, and local times, which don't
+        for options: ISO8601DateFormatter.Options in [[.withInternetDateTime, .withFractionalSeconds], [.withFullDate, .withTime, .withColonSeparatorInTime]] {
+            testFormatter.formatOptions = options
+            testFormatter.timeZone = pacificTimeZone!
+            let context = testFormatter.makeParsingContext()
+            var seconds: Int64 = 1_520_762_400 - 7_200
+            for step in 0..<5_000 {
+                seconds += Int64(step % 11 == 0 ? 86_399 : step % 3)
+                let string = testFormatter.string(fromEpochSeconds: seconds, nanoseconds: 123_000_000)
+                XCTAssertEqual(context.date(from: string), testFormatter.date(from: string))
+                XCTAssertEqual(context.epochSeconds(from: string)?.seconds, testFormatter.epochSeconds(from: string)?.seconds)
+            }
+            // Strings that start the same as the last one but don't parse
+            XCTAssertNotNil(context.date(from: testFormatter.string(fromEpochSeconds: seconds)))
+            XCTAssertNil(context.date(from: String(testFormatter.string(fromEpochSeconds: seconds).prefix(14))))
+            XCTAssertNil(context.date(from: "2018-09-13Tab:56:48Z"))
+        }
+    }
+    
     func testFormattingAcrossTimes() {
         let moreThorough = false
         
@@ -393,6 +824,60 @@ final class JJLISO8601DateFormatterTests: XCTestCase {
         testDatesInParallel(startInterval: 0, endInterval: end, increment: increment)
     }
     
+    func testBatchStringsFromDates() {
+        let dates = (0..<500).map { Date(timeIntervalSince1970: TimeInterval($0) * 7919.123 + 1_000_000_000) }
+        for alwaysUseNSTimeZone in [false, true] {
+            testFormatter.alwaysUseNSTimeZone = alwaysUseNSTimeZone
+            for timeZone in [pacificTimeZone!, brazilTimeZone!, TimeZone(secondsFromGMT: 3600)!] {
+                testFormatter.timeZone = timeZone
+                XCTAssertEqual(testFormatter.strings(from: dates), dates.map { testFormatter.string(from: $0) })
+            }
+        }
+        XCTAssertEqual(testFormatter.strings(from: []), [])
+        // More dates than are formatted at once
+        let manyDates = (0..<150_000).map { Date(timeIntervalSince1970: TimeInterval($0) * 613.7 + 1_000_000_000) }
+        XCTAssertEqual(testFormatter.strings(from: manyDates), manyDates.map { testFormatter.string(from: $0) })
+    }
+    
+    func testBatchDatesFromStrings() {
+        let validStrings = (0..<100).map { appleFormatter.string(from: Date(timeIntervalSince1970: TimeInterval($0) * 7919.123 + 1_000_000_000)) }
+        let invalidStrings = ["", "garbage", "2018-09-13T19:56:48.980", "2018-09-13T19:56:4"]
+        var strings: [String] = []
+        for (i, string) in validStrings.enumerated() {
+            strings.append(string)
+            strings.append(invalidStrings[i % invalidStrings.count])
+        }
+        for alwaysUseNSTimeZone in [false, true] {
+            testFormatter.alwaysUseNSTimeZone = alwaysUseNSTimeZone
+            testFormatter.timeZone = brazilTimeZone
+            let dates = testFormatter.dates(from: strings)
+            XCTAssertEqual(dates, strings.map { testFormatter.date(from: $0) })
+            XCTAssertEqual(dates.compactMap { $0 }.count, validStrings.count)
+        }
+        XCTAssertEqual(testFormatter.dates(from: []), [])
+    }
+    
+    func testDatesFromBytes() {
+        let strings = ["2018-09-13T19:56:48Z", "2018-09-13T16:56:48-03:00", "", "garbage", "2018-09-13T19:56:4"]
+        for alwaysUseNSTimeZone in [false, true] {
+            testFormatter.alwaysUseNSTimeZone = alwaysUseNSTimeZone
+            testFormatter.timeZone = brazilTimeZone
+            for string in strings {
+                let expected = appleFormatter.date(from: string)
+                XCTAssertEqual(testFormatter.date(from: string), expected)
+                XCTAssertEqual(testFormatter.date(from: string.utf8), expected)
+                XCTAssertEqual(testFormatter.date(fromUTF8: Array(string.utf8)), expected)
+                XCTAssertEqual(testFormatter.date(fromUTF8: Data(string.utf8)), expected)
+                XCTAssertEqual(Array(string.utf8).withUnsafeBytes { testFormatter.date(fromUTF8: $0) }, expected)
+                // A slice of a larger string, which isn't followed by a NUL terminator
+                let padded = "[" + string + "]junk"
+                XCTAssertEqual(testFormatter.date(from: padded.dropFirst().prefix(string.count)), expected)
+                // Bridged strings may not have contiguous UTF-8
+                XCTAssertEqual(testFormatter.date(from: NSString(string: string) as String), expected)
+            }
+        }
+    }
+    
     func testNSFormatter() {
         let testString = testFormatter.string(from: testDate)
         XCTAssertEqual(testFormatter.string(for: testDate), testString)